@@ -2,6 +2,8 @@
 // Created by goksu on 2/25/20.
 //
 
+#include <algorithm>
+
 #include "renderer.h"
 #include "scene.h"
 
@@ -9,6 +11,17 @@ inline float Deg2Rad(const float& deg) {
   return deg * kPi / 180.0;
 }
 
+// Writes a PPM/PFM header and the pixel data with one call each; false if the file cannot be written
+inline bool WriteImageFile(const char* path, const char* magic, int width, int height, const char* scale,
+                           const void* data, size_t bytes) {
+  FILE* fp = fopen(path, "wb");
+  if (fp == nullptr)
+    return false;
+  bool ok = fprintf(fp, "%s\n%d %d\n%s\n", magic, width, height, scale) > 0;
+  ok = fwrite(data, 1, bytes, fp) == bytes && ok;
+  return fclose(fp) == 0 && ok;
+}
+
 // The main render function. This where we iterate over all pixels in the image,
 // generate primary rays and cast these rays into the scene. The content of the
 // framebuffer is saved to a file.
@@ -33,15 +46,22 @@ void Renderer::Render(const Scene& scene) {
   }
   UpdateProgress(1.f);
 
-  // save framebuffer to file
-  FILE* fp = fopen("binary.ppm", "wb");
-  (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
+  // save framebuffer to file, in one write
+  std::vector<unsigned char> pixels(3 * scene.width * scene.height);
   for (auto i = 0; i < scene.height * scene.width; ++i) {
-    static unsigned char color[3];
-    color[0] = (unsigned char)(255 * Clamp(0, 1, framebuffer[i].x));
-    color[1] = (unsigned char)(255 * Clamp(0, 1, framebuffer[i].y));
-    color[2] = (unsigned char)(255 * Clamp(0, 1, framebuffer[i].z));
-    fwrite(color, 1, 3, fp);
+    pixels[3 * i + 0] = (unsigned char)(255 * Clamp(0, 1, framebuffer[i].x));
+    pixels[3 * i + 1] = (unsigned char)(255 * Clamp(0, 1, framebuffer[i].y));
+    pixels[3 * i + 2] = (unsigned char)(255 * Clamp(0, 1, framebuffer[i].z));
+  }
+  if (!WriteImageFile("binary.ppm", "P6", scene.width, scene.height, "255", pixels.data(), pixels.size()))
+    std::cerr << "Cannot write binary.ppm\n";
+
+  // and the linear radiance as a little endian PFM, which stores the bottom row first
+  std::vector<Vector3f> rows(framebuffer.size());
+  for (int j = 0; j < scene.height; ++j) {
+    std::copy_n(&framebuffer[j * scene.width], scene.width, &rows[(scene.height - 1 - j) * scene.width]);
   }
-  fclose(fp);
+  if (!WriteImageFile("binary.pfm", "PF", scene.width, scene.height, "-1.0", rows.data(),
+                      rows.size() * sizeof(Vector3f)))
+    std::cerr << "Cannot write binary.pfm\n";
 }
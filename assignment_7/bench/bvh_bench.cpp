@@ -0,0 +1,354 @@
+// Ray throughput of the BVH node layouts on the bunny and the Cornell box, build time against tree quality
+// of the split methods on the bunny and generated heightfields, refitting against rebuilding a deforming heightfield,
+// the cost of instancing the bunny, and editing a scene through a dynamic top level against rebuilding it.
+//
+// usage: bvh_bench [models dir]   (defaults to ../models, i.e. run from the build directory)
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "objects/instance.h"
+#include "objects/mesh_triangle.h"
+#include "objects/sphere.h"
+#include "sampler.h"
+#include "scene.h"
+
+namespace {
+
+Vector3f UniformSphere(Pcg32& rng) {
+  float z = 1 - 2 * rng.UniformFloat();
+  float r = std::sqrt(std::max(0.f, 1 - z * z));
+  float phi = 2 * 3.14159265f * rng.UniformFloat();
+  return Vector3f(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Rays from a sphere around the mesh aimed at random points inside its bounds
+std::vector<Ray> OrbitRays(const Bounds3& bounds, int n) {
+  Pcg32 rng(1, 7);
+  Vector3f center = bounds.Centroid();
+  Vector3f extent = bounds.Diagonal();
+  float radius = 0.75f * std::sqrt(DotProduct(extent, extent));
+  std::vector<Ray> rays;
+  for (int i = 0; i < n; ++i) {
+    Vector3f origin = center + radius * UniformSphere(rng);
+    Vector3f target = bounds.p_min + Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) * extent;
+    rays.emplace_back(origin, Normalize(target - origin));
+  }
+  return rays;
+}
+
+// Camera rays of the Cornell box render plus rays bouncing around inside the box
+std::vector<Ray> CornellRays(const Bounds3& bounds, int width, int height) {
+  std::vector<Ray> rays;
+  float scale = std::tan(40 * 0.5f * 3.14159265f / 180);
+  Vector3f eye_pos(278, 273, -800);
+  for (int j = 0; j < height; ++j) {
+    for (int i = 0; i < width; ++i) {
+      float x = (2 * (i + 0.5f) / width - 1) * scale;
+      float y = (1 - 2 * (j + 0.5f) / height) * scale;
+      rays.emplace_back(eye_pos, Normalize(Vector3f(-x, y, 1)));
+    }
+  }
+  Pcg32 rng(2, 7);
+  Vector3f extent = bounds.Diagonal();
+  for (int i = 0; i < width * height; ++i) {
+    Vector3f origin = bounds.p_min + Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) * extent;
+    rays.emplace_back(origin, UniformSphere(rng));
+  }
+  return rays;
+}
+
+// Shadow rays: the same rays cut off halfway to their closest hit or at a fixed distance
+std::vector<Ray> ShadowRays(const Scene& scene, std::vector<Ray> rays, float max_distance) {
+  Pcg32 rng(3, 7);
+  for (auto& ray : rays) {
+    Intersection hit = scene.Intersect(ray);
+    ray.t_max = rng.UniformFloat() < 0.5f && hit.happened ? hit.distance * 0.5 : max_distance;
+  }
+  return rays;
+}
+
+template <typename Fn>
+double MeasureMraysPerSec(const std::vector<Ray>& rays, Fn&& trace) {
+  int repeats = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  // repeat until the measurement is long enough to be stable
+  while (elapsed < 1.0) {
+    for (const auto& ray : rays) {
+      trace(ray);
+    }
+    ++repeats;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  return rays.size() * repeats / elapsed / 1e6;
+}
+
+// Loads the meshes into a scene for every node layout and measures closest-hit and any-hit throughput
+template <typename RayGen>
+void Run(const char* name, const std::vector<std::string>& files, RayGen&& make_rays, float max_distance) {
+  const BVHAccel::NodeLayout layouts[] = {BVHAccel::NodeLayout::kBinary, BVHAccel::NodeLayout::kWide4};
+  const char* layout_names[] = {"binary", "wide4"};
+  for (int l = 0; l < 2; ++l) {
+    Scene scene(0, 0);
+    scene.bvh_layout = layouts[l];
+    Material material;
+    std::vector<std::unique_ptr<MeshTriangle>> meshes;
+    Bounds3 bounds;
+    int n_triangles = 0;
+    for (const auto& file : files) {
+      meshes.push_back(std::make_unique<MeshTriangle>(file, &material, layouts[l]));
+      scene.Add(meshes.back().get());
+      bounds = Union(bounds, meshes.back()->GetBounds());
+      n_triangles += meshes.back()->triangles.Size();
+    }
+    scene.BuildBVH();
+
+    std::vector<Ray> rays = make_rays(bounds);
+    std::vector<Ray> shadow_rays = ShadowRays(scene, rays, max_distance);
+    int hits = 0;
+    double closest = MeasureMraysPerSec(rays, [&](const Ray& ray) { hits += scene.Intersect(ray).happened; });
+    double any = MeasureMraysPerSec(shadow_rays, [&](const Ray& ray) { hits += scene.IntersectP(ray); });
+    printf("%-8s %-7s %8d tris  closest-hit %7.2f Mrays/s  any-hit %7.2f Mrays/s\n", name, layout_names[l],
+           n_triangles, closest, any);
+  }
+}
+
+// Heightfield of n x n quads, two triangles each, with rolling hills and fine noise: a stand-in for big scans.
+// A swirl > 0 twists it about its center, by swirl radians at the center down to none at the rim, for animations.
+TriangleBlock Terrain(int n, float swirl = 0) {
+  Pcg32 rng(4, 7);
+  std::vector<float> height((n + 1) * (n + 1));
+  for (int j = 0; j <= n; ++j) {
+    for (int i = 0; i <= n; ++i) {
+      float x = (float)i / n, y = (float)j / n;
+      height[j * (n + 1) + i] = 0.1f * std::sin(12 * x) * std::cos(9 * y) + 0.002f * rng.UniformFloat();
+    }
+  }
+  auto vertex = [&](int i, int j) {
+    float x = (float)i / n - 0.5f, z = (float)j / n - 0.5f;
+    float angle = swirl * std::max(0.f, 1 - 2 * std::sqrt(x * x + z * z));
+    float c = std::cos(angle), s = std::sin(angle);
+    return Vector3f(0.5f + c * x - s * z, height[j * (n + 1) + i], 0.5f + s * x + c * z);
+  };
+  TriangleBlock triangles;
+  for (int j = 0; j < n; ++j) {
+    for (int i = 0; i < n; ++i) {
+      triangles.Add(vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1), 0);
+      triangles.Add(vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1), 0);
+    }
+  }
+  return triangles;
+}
+
+TriangleBlock LoadTriangles(const std::string& file) {
+  Material material;
+  MeshTriangle mesh(file, &material, BVHAccel::NodeLayout::kWide4, BVHAccel::SplitMethod::kLBVH);
+  TriangleBlock triangles;
+  for (int i = 0; i < mesh.triangles.Size(); ++i) {
+    Vector3f v0 = mesh.triangles.V0(i);
+    triangles.Add(v0, v0 + mesh.triangles.E1(i), v0 + mesh.triangles.E2(i), 0);
+  }
+  return triangles;
+}
+
+class BlockIntersector : public LeafIntersector {
+public:
+  explicit BlockIntersector(const TriangleBlock& triangles) : triangles_(triangles) {}
+
+  bool Intersect(const Ray& ray, int first, int count, float& t_max) override {
+    int index;
+    float u, v;
+    return triangles_.Intersect(ray, first, count, t_max, index, u, v);
+  }
+
+  bool IntersectP(const Ray& ray, int first, int count, float t_max) override {
+    return triangles_.IntersectP(ray, first, count, t_max);
+  }
+
+private:
+  const TriangleBlock& triangles_;
+};
+
+// Builds a wide BVH over the triangles with every split method and reports build time, SAH cost and
+// closest-hit throughput
+void CompareBuilds(const char* name, const TriangleBlock& triangles) {
+  std::vector<Bounds3> prim_bounds(triangles.Size());
+  Bounds3 bounds;
+  for (int i = 0; i < triangles.Size(); ++i) {
+    prim_bounds[i] = triangles.GetBounds(i);
+    bounds = Union(bounds, prim_bounds[i]);
+  }
+  std::vector<Ray> rays = OrbitRays(bounds, 1 << 16);
+
+  for (auto method : {BVHAccel::SplitMethod::kNaive, BVHAccel::SplitMethod::kSAH, BVHAccel::SplitMethod::kLBVH}) {
+    auto start = std::chrono::steady_clock::now();
+    auto bvh = std::make_unique<BVHAccel>(prim_bounds, 4, method, BVHAccel::NodeLayout::kWide4,
+                                          TriangleBlock::kLanes);
+    double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    TriangleBlock ordered = triangles;
+    ordered.Reorder(bvh->PrimitiveOrder());
+    BlockIntersector leaves(ordered);
+    int hits = 0;
+    double closest = MeasureMraysPerSec(rays, [&](const Ray& ray) { hits += bvh->Intersect(ray, leaves); });
+    printf("%-8s %-6s %8d tris  build %9.1f ms  SAH cost %7.2f  closest-hit %7.2f Mrays/s\n", name,
+           SplitMethodName(method), triangles.Size(), build_ms, bvh->SahCost(), closest);
+  }
+}
+
+// Animates a growing swirl over a terrain and keeps a wide SAH BVH up to date per frame with Refit(), against
+// building it anew every frame. Refit() rebuilds by itself once the tree's SAH cost grew by half.
+void CompareRefit(int n, int frames) {
+  auto bounds_of = [](const TriangleBlock& triangles, const std::vector<int>& order) {
+    std::vector<Bounds3> prim_bounds(triangles.Size());
+    for (int k = 0; k < triangles.Size(); ++k) {
+      prim_bounds[k] = triangles.GetBounds(order[k]);
+    }
+    return prim_bounds;
+  };
+
+  TriangleBlock triangles = Terrain(n);
+  std::vector<int> identity(triangles.Size());
+  for (int i = 0; i < triangles.Size(); ++i) {
+    identity[i] = i;
+  }
+  BVHAccel bvh(bounds_of(triangles, identity), 4, BVHAccel::SplitMethod::kSAH, BVHAccel::NodeLayout::kWide4,
+               TriangleBlock::kLanes);
+  std::vector<int> order = bvh.PrimitiveOrder();  // leaf slot -> triangle of Terrain()
+
+  for (int frame = 1; frame <= frames; ++frame) {
+    triangles = Terrain(n, 0.5f * frame);
+    std::vector<Bounds3> prim_bounds = bounds_of(triangles, order);
+
+    auto start = std::chrono::steady_clock::now();
+    bool rebuilt = bvh.Refit(prim_bounds);
+    double refit_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (rebuilt) {
+      std::vector<int> reordered(order.size());
+      for (size_t k = 0; k < order.size(); ++k) {
+        reordered[k] = order[bvh.PrimitiveOrder()[k]];
+      }
+      order.swap(reordered);
+    }
+
+    start = std::chrono::steady_clock::now();
+    BVHAccel fresh(prim_bounds, 4, BVHAccel::SplitMethod::kSAH, BVHAccel::NodeLayout::kWide4, TriangleBlock::kLanes);
+    double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("%-8s %8d tris  frame %2d  %-7s %9.1f ms  SAH cost %7.2f  rebuild %9.1f ms  SAH cost %7.2f\n", "terrain",
+           triangles.Size(), frame, rebuilt ? "rebuilt" : "refit", refit_ms, bvh.SahCost(), build_ms,
+           fresh.SahCost());
+  }
+}
+
+// Scatters n instances of one mesh with random rotation and scale over a square and measures the top-level build
+// and closest-hit throughput. The mesh and its BVH are shared, so memory grows by one Instance per copy.
+void CompareInstancing(const std::string& file, int n) {
+  Material material;
+  MeshTriangle mesh(file, &material, BVHAccel::NodeLayout::kWide4);
+  Bounds3 mesh_bounds = mesh.GetBounds();
+  float spacing = 1.5f * std::sqrt(DotProduct(mesh_bounds.Diagonal(), mesh_bounds.Diagonal()));
+  int side = std::ceil(std::sqrt((float)n));
+
+  Pcg32 rng(5, 7);
+  std::vector<std::unique_ptr<Instance>> instances;
+  Scene scene(0, 0);
+  for (int k = 0; k < n; ++k) {
+    Transform placement = Transform::Translate(Vector3f(k % side, 0, k / side) * spacing) *
+                          Transform::Rotate(360 * rng.UniformFloat(), Vector3f(0, 1, 0)) *
+                          Transform::Scale(0.5f + rng.UniformFloat()) * Transform::Translate(-mesh_bounds.Centroid());
+    instances.push_back(std::make_unique<Instance>(&mesh, placement));
+    scene.Add(instances.back().get());
+  }
+  auto start = std::chrono::steady_clock::now();
+  scene.BuildBVH();
+  double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<Ray> rays = OrbitRays(scene.bvh->WorldBound(), 1 << 16);
+  int hits = 0;
+  double closest = MeasureMraysPerSec(rays, [&](const Ray& ray) { hits += scene.Intersect(ray).happened; });
+  printf("%-8s %5d instances %10lld tris  top-level build %7.1f ms  +%6.1f KB  closest-hit %7.2f Mrays/s\n", "bunny", n,
+         (long long)n * mesh.triangles.Size(), build_ms, n * sizeof(Instance) / 1024.0, closest);
+}
+
+// Scatters n spheres and edits the scene as a layout tool would, moving, adding and removing one sphere at a time.
+// Reports the time per edit of a dynamic top level against the full BuildBVH() a static one needs, then the
+// closest-hit throughput of the edited dynamic tree against a fresh static build over the same spheres.
+void CompareEditing(int n) {
+  Material material;
+  Pcg32 rng(6, 7);
+  float side = 10 * std::cbrt((float)n);
+  auto random_point = [&]() { return Vector3f(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()) * side; };
+  std::vector<std::unique_ptr<Sphere>> spheres;
+  Scene scene(0, 0);
+  scene.dynamic_top_level = true;
+  for (int i = 0; i < n; ++i) {
+    spheres.push_back(std::make_unique<Sphere>(random_point(), 1 + rng.UniformFloat(), &material));
+    scene.Add(spheres.back().get());
+  }
+  scene.BuildBVH();
+
+  // as many edits of each kind, the scene size stays n
+  constexpr int kEdits = 1000;
+  auto start = std::chrono::steady_clock::now();
+  for (int k = 0; k < kEdits; ++k) {
+    Sphere* sphere = spheres[rng.UniformFloat() * n].get();
+    sphere->center = random_point();
+    scene.Update(sphere);
+  }
+  double move_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  start = std::chrono::steady_clock::now();
+  for (int k = 0; k < kEdits; ++k) {
+    Sphere* sphere = spheres[rng.UniformFloat() * n].get();
+    scene.Remove(sphere);
+    scene.Add(sphere);
+  }
+  double remove_add_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<Ray> rays = OrbitRays(scene.dynamic_bvh->WorldBound(), 1 << 16);
+  int hits = 0;
+  double dynamic_sah = scene.dynamic_bvh->SahCost();
+  double dynamic_closest = MeasureMraysPerSec(rays, [&](const Ray& ray) { hits += scene.Intersect(ray).happened; });
+
+  scene.dynamic_top_level = false;
+  start = std::chrono::steady_clock::now();
+  scene.BuildBVH();
+  double build_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  double static_closest = MeasureMraysPerSec(rays, [&](const Ray& ray) { hits += scene.Intersect(ray).happened; });
+  printf("%-8s %6d objects  move %6.2f us  remove + add %6.2f us  SAH cost %5.2f  closest-hit %5.2f Mrays/s  |  "
+         "rebuild %9.1f us  SAH cost %5.2f  closest-hit %5.2f Mrays/s\n",
+         "spheres", n, move_us / kEdits, remove_add_us / kEdits, dynamic_sah, dynamic_closest, build_us,
+         scene.bvh->SahCost(), static_closest);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string models = argc > 1 ? argv[1] : "../models";
+
+  std::vector<std::string> cornell;
+  for (const char* part : {"floor", "shortbox", "tallbox", "left", "right", "light"}) {
+    cornell.push_back(models + "/cornellbox/" + part + ".obj");
+  }
+
+  printf("\n");
+  Run("bunny", {models + "/bunny/bunny.obj"}, [](const Bounds3& b) { return OrbitRays(b, 1 << 18); }, 0.1f);
+  Run("cornell", cornell, [](const Bounds3& b) { return CornellRays(b, 256, 256); }, 300.f);
+
+  CompareBuilds("bunny", LoadTriangles(models + "/bunny/bunny.obj"));
+  CompareBuilds("terrain", Terrain(256));
+  CompareBuilds("terrain", Terrain(1024));
+
+  CompareRefit(512, 8);
+
+  for (int n : {1, 100, 10000}) {
+    CompareInstancing(models + "/bunny/bunny.obj", n);
+  }
+  for (int n : {1000, 100000}) {
+    CompareEditing(n);
+  }
+  return 0;
+}
@@ -2,6 +2,7 @@
 
 #include "global.h"
 #include "light.h"
+#include "sampler.h"
 #include "utils/vector.h"
 
 class AreaLight : public Light {
@@ -13,10 +14,9 @@ public:
     length = 100;
   }
 
-  Vector3f SamplePoint() const {
-    auto random_u = GetRandomFloat();
-    auto random_v = GetRandomFloat();
-    return position + random_u * u + random_v * v;
+  Vector3f SamplePoint(Sampler& sampler) const {
+    Vector2f random_uv = sampler.Get2D();
+    return position + random_uv.x * u + random_uv.y * v;
   }
 
 public:
@@ -28,7 +28,7 @@ public:
 
   double SurfaceArea() const;
 
-  Vector3f Centroid() { return 0.5 * p_min + 0.5 * p_max; }
+  Vector3f Centroid() const { return 0.5 * p_min + 0.5 * p_max; }
 
   // Returns the intersection of this bounding box and another bounding box.
   // The resulting box represents the overlapping region of the two bounds.
@@ -50,10 +50,44 @@ public:
 
   bool IntersectP(const Ray& ray, const Vector3f& inv_dir, const std::array<bool, 3>& is_dir_neg) const;
 
+  // Slab test restricted to the ray segment [0, t_max]. Unlike the overload above, flat boxes (e.g. around
+  // an axis-aligned quad) still count as hit, which is what BVH traversal needs.
+  // dir_is_neg[i] is 1 if the ray travels towards -i, so it selects which slab plane is entered first.
+  bool IntersectP(const Ray& ray, const Vector3f& inv_dir, const int dir_is_neg[3], float t_max) const;
+
 public:
   Vector3f p_min, p_max;  // two points to specify the bounding box
 };
 
+// Inline so BVH traversal loops can keep it in registers; this is the hottest function of the renderer.
+inline bool Bounds3::IntersectP(const Ray& ray, const Vector3f& inv_dir, const int dir_is_neg[3], float t_max) const {
+  const Bounds3& b = *this;
+  float t_min = 0;
+  // Comparisons are written so that a NaN slab (0 * inf when the origin lies on a slab plane) is ignored
+  float tx_min = (b[dir_is_neg[0]].x - ray.origin.x) * inv_dir.x;
+  float tx_max = (b[1 - dir_is_neg[0]].x - ray.origin.x) * inv_dir.x;
+  if (tx_min > t_min)
+    t_min = tx_min;
+  if (tx_max < t_max)
+    t_max = tx_max;
+
+  float ty_min = (b[dir_is_neg[1]].y - ray.origin.y) * inv_dir.y;
+  float ty_max = (b[1 - dir_is_neg[1]].y - ray.origin.y) * inv_dir.y;
+  if (ty_min > t_min)
+    t_min = ty_min;
+  if (ty_max < t_max)
+    t_max = ty_max;
+
+  float tz_min = (b[dir_is_neg[2]].z - ray.origin.z) * inv_dir.z;
+  float tz_max = (b[1 - dir_is_neg[2]].z - ray.origin.z) * inv_dir.z;
+  if (tz_min > t_min)
+    t_min = tz_min;
+  if (tz_max < t_max)
+    t_max = tz_max;
+
+  return t_min <= t_max;
+}
+
 // ----------------------------------------------------------------------------: helper
 
 Bounds3 Union(const Bounds3& b1, const Bounds3& b2);
@@ -1,43 +1,184 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include "bounds3.h"
 #include "intersection.h"
 #include "objects/object.h"
 #include "ray.h"
+#include "utils/arena.h"
 
 // Forward Declarations
 struct BvhNode;
 struct BvhPrimitiveInfo;
+struct LinearBvhNode;
+struct Bvh4Node;
+struct MortonPrimitive;
 
 // BVHAccel Declarations
 inline int leaf_nodes, total_leaf_nodes, total_primitives, interior_nodes;
 
+// Intersects primitives that live outside the BVH, see the index-based BVHAccel constructor.
+// Ranges [first, first + count) are positions in BVHAccel::PrimitiveOrder().
+class LeafIntersector {
+public:
+  virtual ~LeafIntersector() = default;
+
+  // Returns whether a primitive of the range was hit closer than t_max, lowering t_max to the closest such hit.
+  virtual bool Intersect(const Ray& ray, int first, int count, float& t_max) = 0;
+
+  // Returns whether any primitive of the range blocks the ray before t_max.
+  virtual bool IntersectP(const Ray& ray, int first, int count, float t_max) = 0;
+};
+
 class BVHAccel {
 public:
-  enum class SplitMethod { kNaive, kSAH };
+  // kNaive: median split along the longest axis. kSAH: binned surface area heuristic, best trees.
+  // kLBVH: linear-time HLBVH build from sorted Morton codes with SAH over the top levels, fastest to build.
+  enum class SplitMethod { kNaive, kSAH, kLBVH };
+  // Node layout walked by Intersect()/IntersectP(): the binary tree, or the same tree collapsed to four-wide
+  // nodes whose children are tested together with SIMD.
+  enum class NodeLayout { kBinary, kWide4 };
 
-  BvhNode* root;
+  BvhNode* root = nullptr;  // build tree, in node_block_
 
 public:
-  BVHAccel(std::vector<Object*> p, int max_prims_in_node = 1, SplitMethod split_method = SplitMethod::kNaive);
+  BVHAccel(std::vector<Object*> p, int max_prims_in_node = 1, SplitMethod split_method = SplitMethod::kNaive,
+           NodeLayout layout = NodeLayout::kBinary);
+  // Builds over bare primitive bounds, for primitives that are not Objects (e.g. the triangles of a mesh).
+  // Leaf slot k holds primitive PrimitiveOrder()[k], so callers should store their primitive data in that order
+  // and traverse with a LeafIntersector. A LeafIntersector that tests leaf_batch primitives at once (e.g.
+  // TriangleBlock::kLanes) should say so: SAH then prices a leaf by its batches, not by its primitives.
+  BVHAccel(const std::vector<Bounds3>& prim_bounds, int max_prims_in_node, SplitMethod split_method,
+           NodeLayout layout, int leaf_batch = 1);
+  // Frees the build tree and the flattened nodes in one go; the primitives belong to the caller.
   ~BVHAccel();
 
   Bounds3 WorldBound() const;
+  // Closest hit along the ray, within ray.t_max.
   Intersection Intersect(const Ray& ray) const;
-  Intersection GetIntersection(BvhNode* node, const Ray& ray) const;
+  // Any-hit query for shadow rays: true as soon as some primitive blocks the ray within ray.t_max.
   bool IntersectP(const Ray& ray) const;
-  void GetSample(BvhNode* node, float p, Intersection& pos, float& pdf);
-  void Sample(Intersection& pos, float& pdf);
+  // Same queries over primitives stored outside the BVH; the closest hit itself is tracked by the intersector.
+  bool Intersect(const Ray& ray, LeafIntersector& leaves) const;
+  bool IntersectP(const Ray& ray, LeafIntersector& leaves) const;
+
+  // Expected cost of a random ray against this tree under the surface area heuristic, in units of
+  // one primitive intersection (one batch of leaf_batch primitives): sum of SA(node) / SA(root) * (traversal or leaf
+  // intersection cost). Lower is better; compare across split methods to judge tree quality.
+  double SahCost() const;
+
+  // Default of Refit()'s max_sah_growth
+  static constexpr double kDefaultMaxSahGrowth = 1.5;
+
+  // For primitives that moved or deformed since the build: recomputes every node's bounds bottom-up from the
+  // primitives' current GetBounds(), keeping the tree's topology, in O(n) and in parallel. Once the refitted tree's
+  // SahCost() exceeds max_sah_growth times that of its last build, it is rebuilt from scratch instead.
+  // Returns whether it rebuilt.
+  bool Refit(double max_sah_growth = kDefaultMaxSahGrowth);
+  // Same for a BVH over bare bounds. prim_bounds[k] is the bounds of the primitive in leaf slot k, i.e. it follows
+  // the order the caller stores its primitives in. After a rebuild PrimitiveOrder() is relative to that order, so
+  // the caller reorders its data once more, as after construction.
+  bool Refit(const std::vector<Bounds3>& prim_bounds, double max_sah_growth = kDefaultMaxSahGrowth);
+
+  NodeLayout GetNodeLayout() const { return layout_; }
+
+  const std::vector<int>& PrimitiveOrder() const { return prim_order_; }
 
 private:
-  BvhNode* RecursiveBuild(std::vector<Object*> objects);
+  void Build(std::vector<BvhPrimitiveInfo> infos);
+
+  // Builds the subtree over infos[start, end), reordering that range in place so that every leaf covers a
+  // contiguous part of it. Subtrees of large nodes are built on separate threads while spawn_depth > 0.
+  BvhNode* RecursiveBuild(std::vector<BvhPrimitiveInfo>& infos, int start, int end, int spawn_depth);
+
+  // Hands out the next node of node_block_; lock-free, so concurrent build tasks do not contend.
+  BvhNode* NewNode();
+
+  BvhNode* CreateLeaf(BvhNode* node, const std::vector<BvhPrimitiveInfo>& infos, int start, int end);
+
+  // Binned SAH split. Returns false when a leaf is cheaper than any split and the node may legally become one;
+  // otherwise infos[start, end) is partitioned around *mid.
+  bool SplitSAH(std::vector<BvhPrimitiveInfo>& infos, int start, int end, const Bounds3& bounds,
+                const Bounds3& centroid_bounds, int dim, int* mid) const;
+
+  // HLBVH: sorts infos by the Morton code of their centroids, emits a treelet per run of equal high bits in
+  // parallel and joins the treelets with SAH.
+  BvhNode* LbvhBuild(std::vector<BvhPrimitiveInfo>& infos);
+
+  // Splits infos[start, end) at the highest Morton bit below bit on which its codes differ.
+  BvhNode* EmitLbvh(const std::vector<BvhPrimitiveInfo>& infos, const std::vector<MortonPrimitive>& morton, int start,
+                    int end, int bit);
+
+  // SAH tree over the treelet roots described by infos[start, end)
+  BvhNode* BuildUpperSah(const std::vector<BvhNode*>& treelets, std::vector<BvhPrimitiveInfo>& infos, int start,
+                         int end);
+
+  double SahCost(const BvhNode* node) const;
+
+  // Intersection cost of a leaf of n primitives, which are tested leaf_batch_ at a time
+  double LeafCost(int n) const { return (n + leaf_batch_ - 1) / leaf_batch_; }
+
+  // Recomputes the bounds of the subtree from prim_bounds (by leaf slot), in the build tree and in the node layout,
+  // and returns its SahCost(node). Subtrees are refitted on separate threads while spawn_depth > 0.
+  double RefitNode(BvhNode* node, const std::vector<Bounds3>& prim_bounds, int spawn_depth);
+
+  int CountNodes(const BvhNode* node) const;
+
+  // Lays out the subtree depth-first into nodes_ and returns the index of its root.
+  int FlattenBvhTree(BvhNode* node, int* offset);
+
+  // Collapses the binary subtree below an interior node into wide_nodes_ and returns the index of its root.
+  int CollapseWide(BvhNode* node);
+
+  // Walks the tree and calls leaf(first, count, t_max) for every leaf the ray reaches. The leaf returns whether it
+  // found a hit before t_max, lowering t_max to it; in any-hit mode the first such leaf ends the traversal.
+  template <bool kAnyHit, typename LeafFn>
+  bool Traverse(const Ray& ray, LeafFn&& leaf) const;
+  template <bool kAnyHit, typename LeafFn>
+  bool TraverseBinary(const Ray& ray, LeafFn&& leaf) const;
+  template <bool kAnyHit, typename LeafFn>
+  bool TraverseWide(const Ray& ray, LeafFn&& leaf) const;
 
 private:
   const int max_prims_in_node_;  // primes: primitives
   const SplitMethod split_method_;
-  std::vector<Object*> primitives_;
+  const NodeLayout layout_;
+  const int leaf_batch_;          // primitives a leaf test takes at once
+  const double traversal_cost_;  // of a node visit, relative to one leaf batch
+  std::vector<Object*> primitives_;  // in leaf order; empty for BVHs over bare bounds
+  std::vector<int> prim_order_;       // leaf slot -> primitive number given at construction
+  std::vector<LinearBvhNode> nodes_;  // kBinary: the tree traversed by Intersect(), depth-first order
+  std::vector<Bvh4Node> wide_nodes_;  // kWide4: the collapsed tree, root first
+  double build_sah_cost_ = 0;          // SahCost() right after the last build
+  std::unique_ptr<MemoryArena> node_arena_;  // owns node_block_
+  BvhNode* node_block_ = nullptr;            // room for the 2n - 1 nodes a tree over n primitives can have
+  int max_nodes_ = 0;
+  std::atomic<int> next_node_{0};            // first unused node of node_block_
+};
+
+// Short name of a split method for logs and benchmarks
+const char* SplitMethodName(BVHAccel::SplitMethod split_method);
+
+struct BvhPrimitiveInfo {
+public:
+  BvhPrimitiveInfo() {}
+
+  BvhPrimitiveInfo(size_t prim_number, const Bounds3& bounds)
+      : prim_number(prim_number), bounds(bounds), centroid(bounds.Centroid()) {}
+
+public:
+  size_t prim_number;  // index of the primitive as given to the constructor
+  Bounds3 bounds;
+  Vector3f centroid;
+};
+
+// Primitive of the LBVH build: its position in the build's info array and the Morton code of its centroid
+struct MortonPrimitive {
+  int info_index;
+  uint32_t code;
 };
 
 struct BvhNode {
@@ -46,16 +187,45 @@ public:
     bounds = Bounds3();
     left = nullptr;
     right = nullptr;
-    object = nullptr;
   }
 
 public:
   Bounds3 bounds;
   BvhNode* left;
   BvhNode* right;
-  Object* object;  // stored at leaf node
-  float area;
   int split_axis = 0;
-  int first_prim_offset = 0;
+  int first_prim_offset = 0;  // leaf primitives are primitives_[first_prim_offset, +n_primitives)
   int n_primitives = 0;
+  int subtree_primitives = 0;  // primitives in all leaves below, so Refit() only forks for large subtrees
+  // Where the node layout keeps this node's bounds, for Refit(): kBinary: the index in nodes_; kWide4: the
+  // Bvh4Node and child slot holding its box, -1 for nodes collapsed away.
+  int layout_index = -1;
+  int layout_slot = 0;
+};
+
+// Compact node of the flattened tree, see pbrt-v3 4.3.4
+// The first child of an interior node directly follows it, so only the second child's index is stored.
+struct alignas(32) LinearBvhNode {
+  Bounds3 bounds;
+  union {
+    int primitives_offset;    // leaf
+    int second_child_offset;  // interior
+  };
+  uint16_t n_primitives;  // 0 -> interior node
+  uint8_t axis;           // interior node: split axis
+  uint8_t pad[1];         // ensure 32 byte total size
 };
+
+static_assert(sizeof(LinearBvhNode) == 32, "LinearBvhNode should fill half a cache line");
+
+// Node of the collapsed four-wide tree. Child boxes are stored as structure of arrays, bounds[k][axis][i] being
+// the min (k = 0) or max (k = 1) corner of child i, so that one SSE slab test covers all four children.
+// Unused slots carry an inverted empty box that no ray can hit.
+struct alignas(64) Bvh4Node {
+  float bounds[2][3][4];
+  int child[4];               // interior child: index into wide_nodes_; leaf child: first primitive
+  uint8_t n_primitives[4];    // 0 -> interior child
+  uint8_t pad[12];            // ensure 128 byte total size
+};
+
+static_assert(sizeof(Bvh4Node) == 128, "Bvh4Node should fill two cache lines");
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include "utils/vector.h"
+
+// Feature buffers of the first visible surface of every pixel, averaged over its jittered camera rays.
+// Pixels that see nothing have zero albedo and normal and infinite depth.
+struct GuideBuffers {
+  int width = 0;
+  int height = 0;
+  std::vector<Vector3f> albedo;  // Material::kd of diffuse surfaces, ks of the others
+  std::vector<Vector3f> normal;
+  std::vector<float> depth;  // distance from the camera
+};
+
+// Edge-avoiding À-trous wavelet filter (Dammertz et al., "Edge-Avoiding À-Trous Wavelet Transform for fast Global
+// Illumination Filtering", HPG 2010).
+//
+// The color is divided by the albedo first, so the filter only smooths the illumination and textures or material
+// edges survive untouched; the albedo is multiplied back in at the end. Every iteration convolves with a 5x5 B3
+// spline kernel whose taps lie 2^i pixels apart, and weights each tap down by how much its color, normal, depth and
+// albedo differ from the center pixel's. Five iterations cover a 61x61 footprint at 25 taps per pixel each.
+//
+// Buffers are planar floats and the taps are applied to whole rows at a time, so the inner loops run over
+// contiguous memory without branches and vectorize; rows are filtered in parallel.
+class AtrousDenoiser {
+public:
+  // Filters color (width * height pixels, linear radiance) guided by guides, writing the result to out.
+  void Denoise(const std::vector<Vector3f>& color, const GuideBuffers& guides, std::vector<Vector3f>& out) const;
+
+public:
+  int iterations = 5;
+  float sigma_color = 1.f;    // on the demodulated color, halved every iteration as the noise goes down
+  float sigma_normal = 0.3f;  // on the distance between unit normals
+  float sigma_depth = 0.05f;  // on the depth difference relative to the center depth
+  float sigma_albedo = 0.1f;
+  int num_threads = 0;  // 0: one worker per hardware thread
+};
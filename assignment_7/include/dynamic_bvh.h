@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+
+#include "bounds3.h"
+#include "intersection.h"
+#include "objects/object.h"
+#include "ray.h"
+
+// Incremental binary BVH over Objects for scenes edited live, in the style of the dynamic AABB trees of physics
+// engines (Box2D's b2DynamicTree). Objects are inserted, removed and moved one at a time in O(log n), without
+// rebuilding anything:
+//   - Insert searches for the sibling that adds the least surface area to the tree (branch and bound, as in
+//     Bittner et al., "Incremental BVH Construction for Ray Tracing", 2015), pairs the new leaf with it under a new
+//     parent and refits the ancestors.
+//   - Remove replaces the leaf's parent by its sibling and refits the ancestors.
+//   - Move is a Remove followed by an Insert at the object's new bounds.
+// While refitting, every ancestor tries the four rotations that swap one of its children with a grandchild on the
+// other side (Kopta et al., "Fast, Effective BVH Updates for Animated Scenes", I3D 2012) and keeps the one that
+// shrinks the surface area most, so the tree does not degrade as edits accumulate.
+//
+// Nodes live in one array and are recycled through a free list; a proxy is the index of an object's leaf.
+// Slower to trace than a BVHAccel built over the same objects, so a scene that stops changing is better off
+// with a full build.
+class DynamicBvh {
+public:
+  static constexpr int kNullNode = -1;
+
+  // Adds the object at its current GetBounds() and returns its proxy, the handle for Remove() and Move().
+  int Insert(Object* object);
+
+  void Remove(int proxy);
+
+  // Call after the bounds of the object behind proxy changed. The proxy stays valid.
+  void Move(int proxy);
+
+  Object* GetObject(int proxy) const { return nodes_[proxy].object; }
+
+  int Size() const { return n_objects_; }
+
+  Bounds3 WorldBound() const { return root_ == kNullNode ? Bounds3() : nodes_[root_].bounds; }
+
+  // Longest path from the root to a leaf, in edges
+  int Height() const { return root_ == kNullNode ? 0 : nodes_[root_].height; }
+
+  // Closest hit along the ray, within ray.t_max.
+  Intersection Intersect(const Ray& ray) const;
+
+  // Any-hit query for shadow rays: true as soon as some object blocks the ray within ray.t_max.
+  bool IntersectP(const Ray& ray) const;
+
+  // Same measure as BVHAccel::SahCost(), one object per leaf
+  double SahCost() const;
+
+private:
+  struct Node {
+    bool IsLeaf() const { return child[0] == kNullNode; }
+
+    Bounds3 bounds;
+    Object* object = nullptr;  // leaf only
+    int parent = kNullNode;    // next free node while on the free list
+    int child[2] = {kNullNode, kNullNode};
+    int height = 0;  // 0 for leaves
+  };
+
+  // Node considered as the sibling of a leaf being inserted, with the growth of its ancestors
+  struct Candidate {
+    int node;
+    double inherited_cost;
+  };
+
+  int AllocateNode();
+
+  void FreeNode(int index);
+
+  void InsertLeaf(int leaf);
+
+  void RemoveLeaf(int leaf);
+
+  // Walks from index up to the root, recomputing bounds and heights and rotating where that pays off
+  void Refit(int index);
+
+  // Applies the best of the four child-grandchild swaps below interior node index, if any shrinks the tree
+  void Rotate(int index);
+
+  // Recomputes bounds and height of an interior node from its children
+  void Update(int index);
+
+  // Walks the tree and calls leaf(object, t_max) for every leaf the ray reaches. The leaf returns whether it found
+  // a hit before t_max, lowering t_max to it; in any-hit mode the first such leaf ends the traversal.
+  template <bool kAnyHit, typename LeafFn>
+  bool Traverse(const Ray& ray, LeafFn&& leaf) const;
+
+private:
+  std::vector<Node> nodes_;
+  int root_ = kNullNode;
+  int free_list_ = kNullNode;
+  int n_objects_ = 0;
+  std::vector<Candidate> candidates_;  // search heap of InsertLeaf(), kept to save allocations
+};
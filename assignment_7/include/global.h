@@ -3,7 +3,6 @@
 #include <cmath>
 #include <iostream>
 #include <limits>
-#include <random>
 
 constexpr float kPi = 3.141592653589793f;
 constexpr float kEpsilon = 0.00001f;
@@ -29,13 +28,6 @@ inline bool SolveQuadratic(const float& a, const float& b, const float& c, float
   return true;
 }
 
-inline float GetRandomFloat() {
-  std::random_device dev;
-  std::mt19937 rng(dev());
-  std::uniform_real_distribution<float> dist(0.f, 1.f);
-  return dist(rng);
-}
-
 inline void UpdateProgress(float progress) {
   int bar_width = 70;
 
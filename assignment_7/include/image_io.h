@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class ExrCompression { kNone, kRle };
+
+// Streams an image of float pixels to a file in bands of rows, top row first. Each band is encoded into one buffer
+// and written to its final place in the file with a single call, so a caller never needs to hold more than the band
+// it is writing. The format follows the file extension:
+//   .ppm  8-bit, clamped and gamma corrected the way the renderer has always saved its image (P6, P5 for 1 channel)
+//   .pfm  linear 32-bit float, little endian (PF, Pf for 1 channel)
+//   .exr  OpenEXR scanline image of 32-bit float channels, uncompressed or RLE. Three channels are named R, G, B,
+//         a single channel Y.
+class ImageWriter {
+public:
+  virtual ~ImageWriter();
+
+  // Appends count rows of width * channels interleaved floats each
+  virtual bool WriteRows(const float* pixels, int count) = 0;
+
+  // Completes the file; false if anything went wrong since it was opened. Called by the destructor otherwise.
+  bool Close();
+
+  int Width() const { return width_; }
+
+  int Height() const { return height_; }
+
+  int Channels() const { return channels_; }
+
+protected:
+  ImageWriter(FILE* fp, int width, int height, int channels);
+
+  // Called by Close() before the file is closed, e.g. to fill in an offset table
+  virtual bool Finish() { return true; }
+
+  bool Write(const void* data, size_t bytes);
+
+  bool Seek(long offset);
+
+protected:
+  FILE* fp_;
+  const int width_;
+  const int height_;
+  const int channels_;
+  int next_row_ = 0;
+  bool ok_ = true;
+  std::vector<char> buffer_;  // the band being encoded
+};
+
+// Opens path for writing in the format of its extension; nullptr if the extension is unknown, channels is not 1 or
+// 3, or the file cannot be created.
+std::unique_ptr<ImageWriter> CreateImageWriter(const std::string& path, int width, int height, int channels,
+                                               ExrCompression exr_compression = ExrCompression::kRle);
+
+// Writes a whole image at once
+bool WriteImage(const std::string& path, int width, int height, int channels, const float* pixels,
+                ExrCompression exr_compression = ExrCompression::kRle);
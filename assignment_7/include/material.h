@@ -1,8 +1,13 @@
 #pragma once
 
+#include "sampler.h"
 #include "utils/vector.h"
 
-enum MaterialType { kDiffuse };
+// kDiffuse: Lambertian with albedo kd.
+// kConductor: GGX microfacet metal, reflectance ks at normal incidence (Schlick Fresnel).
+// kDielectric: GGX microfacet glass with index ior, reflecting and refracting, tinted by ks.
+// Microfacet roughness follows specular_exponent through alpha = sqrt(2 / (specular_exponent + 2)).
+enum MaterialType { kDiffuse, kConductor, kDielectric };
 
 class Material {
 public:
@@ -17,9 +22,12 @@ public:
   bool HasEmission();
 
   // sample a ray by Material properties
-  Vector3f Sample(const Vector3f& wi, const Vector3f& N);
+  // wi is the incoming ray direction (towards the surface), the returned wo points away from it. Diffuse and
+  // conductor lobes are importance sampled in proportion to cos and to the GGX normal distribution respectively.
+  Vector3f Sample(const Vector3f& wi, const Vector3f& N, Sampler& sampler);
 
   // given a ray, calculate the PdF of this ray
+  // Solid angle density of Sample() returning wo.
   float Pdf(const Vector3f& wi, const Vector3f& wo, const Vector3f& N);
 
   // given a ray, calculate the contribution of this ray
@@ -48,10 +56,13 @@ private:
 
   Vector3f ToWorld(const Vector3f& a, const Vector3f& N);
 
+  // GGX alpha derived from specular_exponent
+  float Roughness() const;
+
 public:
   MaterialType type;
   Vector3f emission;
-  float ior;
-  Vector3f kd, ks;
-  float specular_exponent;
+  float ior = 1.5f;
+  Vector3f kd, ks = Vector3f(1.f);
+  float specular_exponent = 25.f;
 };
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include "material.h"
+#include "objects/mesh_triangle.h"
+#include "objects/object.h"
+#include "utils/alias_table.h"
+#include "utils/transform.h"
+
+// A placement of a shared mesh: the mesh and its BVH (the bottom level) are stored once, and every instance adds
+// only a transform and an optional material. Added to a Scene in place of the mesh, instances
+// make up the top level the scene BVH is built over. Rays are taken into the mesh's object space to be traced
+// there, and hits are brought back to world space.
+class Instance : public Object {
+public:
+  // mesh must outlive the instance. A null material keeps the materials of the mesh.
+  Instance(MeshTriangle* mesh, const Transform& object_to_world, Material* material = nullptr);
+
+  bool Intersect(const Ray& ray) override;
+
+  bool Intersect(const Ray& ray, float& tnear, uint32_t& index) const override;
+
+  Intersection GetIntersection(Ray ray) override;
+
+  void GetSurfaceProperties(const Vector3f& P, const Vector3f& I, const uint32_t& index, const Vector2f& uv,
+                            Vector3f& N, Vector2f& st) const override;
+
+  Vector3f EvalDiffuseColor(const Vector2f& st) const override { return mesh_->EvalDiffuseColor(st); }
+
+  // Follows the mesh through MeshTriangle::Refit()
+  Bounds3 GetBounds() override { return transform_.Bounds(mesh_->GetBounds()); }
+
+  // World space area, computed on first use and again after the mesh was refit
+  float GetArea() override;
+
+  // Uniform over the world space surface, whatever the transform does to the triangles' relative areas
+  void Sample(Intersection& pos, float& pdf, Sampler& sampler) override;
+
+  bool HasEmit() override { return material_ ? material_->HasEmission() : mesh_->HasEmit(); }
+
+private:
+  // Sums up the world space triangle areas into area_ and triangle_table_
+  void ComputeArea();
+
+private:
+  MeshTriangle* mesh_;
+  Transform transform_;   // object to world
+  Material* material_;    // overrides the mesh's materials unless null
+  std::mutex area_mutex_;
+  std::atomic<int> area_refit_count_{-1};  // mesh_->RefitCount() that area_ and triangle_table_ were computed at
+  float area_ = 0;
+  AliasTable triangle_table_;  // triangles weighted by world space area
+};
@@ -5,13 +5,16 @@
 #include "bvh.h"
 #include "material.h"
 #include "objects/object.h"
-#include "objects/triangle.h"
+#include "objects/triangle_block.h"
+#include "utils/alias_table.h"
 
 class MeshTriangle : public Object {
 public:
-  MeshTriangle(const std::string& filename, Material* mt = new Material());
+  MeshTriangle(const std::string& filename, Material* mt = new Material(),
+               BVHAccel::NodeLayout bvh_layout = BVHAccel::NodeLayout::kWide4,
+               BVHAccel::SplitMethod bvh_split = BVHAccel::SplitMethod::kSAH);
 
-  bool Intersect(const Ray& ray) override { return true; }
+  bool Intersect(const Ray& ray) override;
 
   bool Intersect(const Ray& ray, float& tnear, uint32_t& index) const override;
 
@@ -24,20 +27,36 @@ public:
 
   Intersection GetIntersection(Ray ray) override;
 
-  void Sample(Intersection& pos, float& pdf) override;
+  void Sample(Intersection& pos, float& pdf, Sampler& sampler) override;
 
   float GetArea() override { return area; }
 
   bool HasEmit() override { return m->HasEmission(); }
 
+  // Call after moving triangles with triangles.Set(): refits the BVH to them, and updates the bounds, the area and
+  // the sampling table. Should the BVH rebuild instead, the triangles are stored in its new leaf order, so their
+  // indices change.
+  void Refit();
+
+  // Number of Refit() calls so far, for instances that cache what they derive from the triangles
+  int RefitCount() const { return refit_count_; }
+
+private:
+  // Sums up the triangle areas into area and triangle_table
+  void ComputeArea();
+
+  int refit_count_ = 0;
+
 public:
   Bounds3 bounding_box;
   std::unique_ptr<Vector3f[]> vertices;
   uint32_t num_triangles;
   std::unique_ptr<uint32_t[]> vertex_index;
   std::unique_ptr<Vector2f[]> st_coordinates;
-  std::vector<Triangle> triangles;
-  BVHAccel* bvh;
+  TriangleBlock triangles;          // in BVH leaf order
+  AliasTable triangle_table;        // triangles weighted by area, for Sample()
+  std::vector<Material*> materials;  // indexed by TriangleBlock::MaterialIndex()
+  std::unique_ptr<BVHAccel> bvh;
   float area;
   Material* m;
 };
@@ -4,6 +4,7 @@
 #include "bounds3.h"
 #include "intersection.h"
 #include "ray.h"
+#include "sampler.h"
 #include "utils/vector.h"
 
 class Object {
@@ -12,6 +13,7 @@ public:
 
   virtual ~Object() {}
 
+  // Occlusion query: true if the ray hits the object anywhere in (0, ray.t_max)
   virtual bool Intersect(const Ray& ray) = 0;
   virtual bool Intersect(const Ray& ray, float&, uint32_t&) const = 0;
   virtual Intersection GetIntersection(Ray _ray) = 0;
@@ -20,6 +22,6 @@ public:
   virtual Vector3f EvalDiffuseColor(const Vector2f&) const = 0;
   virtual Bounds3 GetBounds() = 0;
   virtual float GetArea() = 0;
-  virtual void Sample(Intersection& pos, float& pdf) = 0;
+  virtual void Sample(Intersection& pos, float& pdf, Sampler& sampler) = 0;
   virtual bool HasEmit() = 0;
 };
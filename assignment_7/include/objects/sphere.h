@@ -24,7 +24,7 @@ public:
 
   Bounds3 GetBounds() override;
 
-  void Sample(Intersection& pos, float& pdf) override;
+  void Sample(Intersection& pos, float& pdf, Sampler& sampler) override;
 
   float GetArea() override { return area; }
 
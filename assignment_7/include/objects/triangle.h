@@ -27,7 +27,7 @@ public:
   Vector3f EvalDiffuseColor(const Vector2f&) const override;
   Bounds3 GetBounds() override;
 
-  void Sample(Intersection& pos, float& pdf) override;
+  void Sample(Intersection& pos, float& pdf, Sampler& sampler) override;
 
   float GetArea() override;
 
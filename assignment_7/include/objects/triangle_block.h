@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bounds3.h"
+#include "ray.h"
+#include "utils/vector.h"
+
+// Triangles of a mesh stored as structure of arrays. Per triangle only what Moller-Trumbore needs is kept:
+// v0, the edges e1 = v1 - v0 and e2 = v2 - v0, plus a material index, 38 bytes in total.
+// The arrays are padded with degenerate triangles so that any range can be read kLanes at a time.
+class TriangleBlock {
+public:
+  static constexpr int kLanes = 4;
+
+  void Add(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2, uint16_t material_index);
+
+  // Moves the vertices of triangle i, keeping its material
+  void Set(int i, const Vector3f& v0, const Vector3f& v1, const Vector3f& v2);
+
+  // Permutes the triangles so that triangle k becomes the one that was at order[k]
+  void Reorder(const std::vector<int>& order);
+
+  int Size() const { return size_; }
+
+  Vector3f V0(int i) const { return Vector3f(v0_[0][i], v0_[1][i], v0_[2][i]); }
+
+  Vector3f E1(int i) const { return Vector3f(e1_[0][i], e1_[1][i], e1_[2][i]); }
+
+  Vector3f E2(int i) const { return Vector3f(e2_[0][i], e2_[1][i], e2_[2][i]); }
+
+  Vector3f Normal(int i) const { return Normalize(CrossProduct(E1(i), E2(i))); }
+
+  float Area(int i) const { return CrossProduct(E1(i), E2(i)).Norm() * 0.5f; }
+
+  Bounds3 GetBounds(int i) const { return Union(Bounds3(V0(i), V0(i) + E1(i)), V0(i) + E2(i)); }
+
+  uint16_t MaterialIndex(int i) const { return material_[i]; }
+
+  // Closest hit, from either side, among triangles [first, first + count) before t_max, tested kLanes at a time.
+  // On success lowers t_max to the hit and reports the triangle and its barycentric coordinates.
+  bool Intersect(const Ray& ray, int first, int count, float& t_max, int& index, float& u, float& v) const;
+
+  // Returns whether any triangle of [first, first + count) is hit before t_max.
+  bool IntersectP(const Ray& ray, int first, int count, float t_max) const;
+
+private:
+  // Tests triangles [i, i + kLanes), of which the first n_valid are real, and returns the bit mask of those hit in
+  // [0, t_max) together with their distances and barycentric coordinates.
+  int IntersectLanes(const Ray& ray, int i, int n_valid, float t_max, float t[kLanes], float u[kLanes],
+                     float v[kLanes]) const;
+
+private:
+  int size_ = 0;
+  std::vector<float> v0_[3], e1_[3], e2_[3];  // x, y, z arrays, size_ + kLanes - 1 long
+  std::vector<uint16_t> material_;
+};
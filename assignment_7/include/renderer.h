@@ -1,5 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include "denoiser.h"
+#include "image_io.h"
+#include "sampler.h"
 #include "scene.h"
 
 struct HitPayload {
@@ -9,10 +16,139 @@ struct HitPayload {
   Object* hit_obj;
 };
 
+// A rectangular block of pixels [x0, x1) x [y0, y1) rendered by one worker at a time.
+struct Tile {
+  int x0, y0;
+  int x1, y1;
+};
+
+// Running mean and variance of the samples of one pixel (Welford's method). The variance is tracked on luminance.
+struct PixelStats {
+  int n = 0;
+  Vector3f mean;
+  double mean_luminance = 0;
+  double m2 = 0;  // sum of squared deviations from mean_luminance
+
+  void Add(const Vector3f& sample);
+
+  // Standard error of the mean luminance relative to it
+  double RelativeError() const;
+};
+
+// Accumulated samples of a progressive render, everything a checkpoint needs to resume it
+struct RenderState {
+  int passes = 0;
+  std::vector<Vector3f> accumulation;   // sum of the samples of each pixel
+  std::vector<uint32_t> sample_counts;  // samples taken by each pixel
+
+  // Writes the mean of each pixel
+  void Resolve(std::vector<Vector3f>& framebuffer) const;
+};
+
+// Output variables the renderer can write next to the image
+enum class Aov {
+  kAlbedo,       // first-hit albedo
+  kNormal,       // first-hit normal
+  kDepth,        // first-hit distance from the camera, infinite where nothing is hit
+  kSampleCount,  // samples taken by each pixel
+};
+
+const char* AovName(Aov aov);
+
+// output_file with the AOV's name inserted before the extension, e.g. image.exr -> image.normal.exr
+std::string AovPath(const std::string& output_file, Aov aov);
+
 class Renderer {
 public:
   // The main render function.
   // This where we iterate over all pixels in the image, generate primary rays and cast these
   // rays into the scene. The content of the framebuffer is saved to a file.
   void Render(const Scene& scene);
+
+  // Writes a framebuffer in the format of the file extension, see ImageWriter
+  void SaveImage(const std::string& file, const Scene& scene, const std::vector<Vector3f>& framebuffer) const;
+
+private:
+  std::vector<Tile> MakeTiles(const Scene& scene) const;
+
+  // Renders every pixel of the tile straight into the shared framebuffer, whose first row is image row first_row.
+  // Tiles never overlap, so workers need no locking.
+  void RenderTile(const Scene& scene, const Tile& tile, std::vector<Vector3f>& framebuffer, int first_row = 0) const;
+
+  // Renders a band of tile rows at a time into a small ring of band buffers, each written to output_file in
+  // scanline order once its last tile is done, and reused for a later band. Memory stays bounded by the bands in
+  // flight, whatever the image size.
+  void RenderStreamed(const Scene& scene) const;
+
+  // Renders in passes: every pixel first takes adaptive_min_spp samples (spp if that is lower), after which each
+  // pass adds as many to the pixels whose relative error is still above adaptive_threshold, worst first, until none
+  // is left or the budget of spp samples per pixel on average is spent.
+  void RenderAdaptive(const Scene& scene, std::vector<Vector3f>& framebuffer,
+                      std::vector<uint32_t>& sample_counts) const;
+
+  // Renders one sample per pixel per pass into an accumulation buffer, until spp passes are done, the next pass
+  // would overrun time_budget, or cancel is set. Returns the number of passes.
+  int RenderProgressive(const Scene& scene, std::vector<Vector3f>& framebuffer,
+                        std::vector<uint32_t>& sample_counts) const;
+
+  // First-hit albedo, normal and depth of every pixel, averaged over the camera rays of its first guide_samples
+  // samples
+  GuideBuffers RenderGuides(const Scene& scene) const;
+
+  // Restores state from a checkpoint written for the same image size, seed, sampler and path depth; false if there
+  // is none or it does not match.
+  bool LoadCheckpoint(const std::string& file, const Scene& scene, RenderState& state) const;
+
+  void SaveCheckpoint(const std::string& file, const Scene& scene, const RenderState& state) const;
+
+  // Radiance of sample k of pixel (i, j)
+  Vector3f SamplePixel(const Scene& scene, Sampler& sampler, int i, int j, int k) const;
+
+  // Camera ray through the point (i + jitter.x, j + jitter.y) of the image plane
+  Ray CameraRay(const Scene& scene, int i, int j, const Vector2f& jitter) const;
+
+public:
+  // The image is written here; .ppm gives the clamped, gamma corrected 8-bit image, .pfm and .exr linear floats.
+  // Every AOV asked for is written in the same format, to AovPath(output_file, aov).
+  std::string output_file = "binary.ppm";
+  std::vector<Aov> aovs;
+  ExrCompression exr_compression = ExrCompression::kRle;
+  // Stream the image to output_file band by band instead of keeping it whole. Only for plain renders: adaptive and
+  // progressive sampling, denoising and AOVs need the whole image and are not available then.
+  bool stream_output = false;
+
+  // change the spp value to change sample ammount
+  int spp = 16;
+  int num_threads = 0;  // 0: one worker per hardware thread
+  int tile_size = 32;   // edge length of the square tiles handed out to workers
+  uint64_t seed = 0;    // same seed, same image
+  SamplerType sampler_type = SamplerType::kSobol;
+  // If positive, each pixel traces the camera rays of its first first_hit_samples samples only and every later sample
+  // k starts its path from the cached hit of sample k % first_hit_samples. Their jittered positions are stratified
+  // over the pixel, so this caps the antialiasing at that many positions but saves the camera ray traversals.
+  int first_hit_samples = 0;
+
+  // Adaptive sampling; spp then is the average number of samples per pixel
+  bool adaptive = false;
+  int adaptive_min_spp = 4;          // samples per pixel of the first pass, and added to a pixel per pass
+  int adaptive_max_spp = 1024;       // no pixel takes more
+  float adaptive_threshold = 0.02f;  // relative error at which a pixel counts as converged
+  std::string heat_map_file;         // adaptive renders write the samples taken per pixel here, unless empty
+
+  // Progressive rendering; spp then is the target number of passes
+  bool progressive = false;
+  double time_budget = 0;  // wall-clock seconds a progressive render may take, 0 for no limit
+  // Called after every progressive pass with the image so far and its samples per pixel
+  std::function<void(const std::vector<Vector3f>& framebuffer, int spp)> on_pass;
+  // If set, a progressive render resumes from this checkpoint when it exists and rewrites it every
+  // checkpoint_interval seconds and when it stops. Resuming continues every pixel's sample sequence where it left
+  // off, so the image is bit-identical to that of an uninterrupted render.
+  std::string checkpoint_file;
+  double checkpoint_interval = 60;
+  // Post-process the image with the À-trous denoiser
+  bool denoise = false;
+  AtrousDenoiser denoiser;
+  int guide_samples = 4;
+  // Set from any thread, or a signal handler, to end a progressive render after the pass in flight
+  std::atomic<bool> cancel{false};
 };
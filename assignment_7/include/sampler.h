@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "utils/vector.h"
+
+// ----------------------------------------------------------------------------: helper
+
+// Mixes the bits of a 64-bit value (splitmix64 finalizer), used to derive well separated seeds.
+inline uint64_t MixBits(uint64_t v) {
+  v ^= (v >> 31);
+  v *= 0x7fb5d329728ea185ULL;
+  v ^= (v >> 27);
+  v *= 0x81dadef4bc2dd44dULL;
+  v ^= (v >> 33);
+  return v;
+}
+
+// PCG32 generator (https://www.pcg-random.org): 16 bytes of state and a few cycles per number.
+// Every sequence index selects an independent stream, and Advance() jumps ahead in O(log n).
+class Pcg32 {
+public:
+  Pcg32() { SetSequence(kDefaultStream, kDefaultState); }
+
+  Pcg32(uint64_t seq_index, uint64_t seed) { SetSequence(seq_index, seed); }
+
+  void SetSequence(uint64_t seq_index, uint64_t seed = kDefaultState);
+
+  void Advance(int64_t delta);
+
+  uint32_t Uniform32();
+
+  // Uniform float in [0, 1)
+  float UniformFloat();
+
+private:
+  static constexpr uint64_t kDefaultState = 0x853c49e6748fea9bULL;
+  static constexpr uint64_t kDefaultStream = 0xda3e39cb94b95bdbULL;
+  static constexpr uint64_t kMultiplier = 0x5851f42d4c957f2dULL;
+
+  uint64_t state_, inc_;
+};
+
+// ----------------------------------------------------------------------------: class
+
+// Source of the sample values consumed along a path.
+// A sampler is owned by one thread; StartPixelSample() makes the values drawn afterwards a
+// deterministic function of (pixel, sample index, seed), so renders are reproducible.
+// Every Get1D()/Get2D() call consumes one dimension. Consumers that draw a varying number of values, such as the
+// bounces of a path, jump to fixed dimensions with SetDimension() so that each decision keeps its own dimension
+// across the samples of a pixel, which is what stratifies it.
+class Sampler {
+public:
+  virtual ~Sampler() = default;
+
+  virtual void StartPixelSample(int x, int y, int sample_index) = 0;
+
+  virtual float Get1D() = 0;
+
+  virtual Vector2f Get2D() = 0;
+
+  void SetDimension(int dimension) { dimension_ = dimension; }
+
+  int Dimension() const { return dimension_; }
+
+protected:
+  int dimension_ = 0;
+};
+
+enum class SamplerType { kIndependent, kSobol };
+
+std::unique_ptr<Sampler> CreateSampler(SamplerType type, uint64_t seed);
+
+// Independent uniform random samples drawn from a PCG32 stream per pixel.
+class IndependentSampler : public Sampler {
+public:
+  explicit IndependentSampler(uint64_t seed = 0) : seed_(seed) {}
+
+  void StartPixelSample(int x, int y, int sample_index) override;
+
+  float Get1D() override { return rng_.UniformFloat(); }
+
+  Vector2f Get2D() override {
+    float u = rng_.UniformFloat();
+    return Vector2f(u, rng_.UniformFloat());
+  }
+
+private:
+  uint64_t seed_;
+  Pcg32 rng_;
+};
+
+// Owen-scrambled Sobol points, padded and shuffled per dimension as in Burley, "Practical Hash-based Owen
+// Scrambling" (JCGT 2020). Every dimension draws the first two Sobol dimensions, Owen scrambled with hash-based
+// nested uniform scrambling, at a sample index shuffled by a per pixel and per dimension scramble. The samples of a
+// pixel are therefore stratified in each 1D and 2D dimension, while dimensions and pixels stay uncorrelated.
+class SobolSampler : public Sampler {
+public:
+  explicit SobolSampler(uint64_t seed = 0) : seed_(seed) {}
+
+  void StartPixelSample(int x, int y, int sample_index) override;
+
+  float Get1D() override;
+
+  Vector2f Get2D() override;
+
+private:
+  // Scramble seed of the current dimension
+  uint32_t DimensionSeed() const { return (uint32_t)MixBits(pixel_seed_ ^ (uint64_t)dimension_); }
+
+private:
+  uint64_t seed_;
+  uint64_t pixel_seed_ = 0;
+  uint32_t sample_index_ = 0;
+};
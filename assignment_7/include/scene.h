@@ -1,20 +1,34 @@
 #pragma once
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "area_light.h"
 #include "bvh.h"
+#include "dynamic_bvh.h"
 #include "light.h"
 #include "objects/object.h"
 #include "ray.h"
+#include "sampler.h"
+#include "utils/alias_table.h"
 #include "utils/vector.h"
 
 class Scene {
 public:
   Scene(int w, int h) : width(w), height(h) {}
 
-  void Add(Object* object) { objects.push_back(object); }
+  // With a dynamic top level the BVH takes the object in right away, otherwise call BuildBVH() once done adding.
+  void Add(Object* object);
+
+  // Takes an object out of the scene. With a dynamic top level this is O(log n) and the last object takes the
+  // removed one's place in objects; otherwise the BVH must be rebuilt. Returns false, changing nothing, for an
+  // object that is not in the scene.
+  bool Remove(Object* object);
+
+  // Call after an object moved or changed shape while the scene is being edited: a dynamic top level moves its
+  // leaf in O(log n). Static BVHs need RefitBVH() or BuildBVH().
+  void Update(Object* object);
 
   void Add(std::unique_ptr<Light> light) { lights.push_back(std::move(light)); }
 
@@ -24,11 +38,31 @@ public:
 
   Intersection Intersect(const Ray& ray) const;
 
+  // Any-hit query: true if something blocks the ray before ray.t_max.
+  bool IntersectP(const Ray& ray) const;
+
+  // Visibility query for next-event estimation: true if the segment between two surface points is unblocked.
+  // Both ends are pulled in by a small epsilon so the surfaces they lie on do not occlude themselves.
+  bool Visible(const Vector3f& p0, const Vector3f& p1) const;
+
+  // Builds the BVH over the objects and the emitter sampling table; call again after changing the scene, unless the
+  // top level is dynamic.
   void BuildBVH();
 
-  Vector3f CastRay(const Ray& ray, int depth) const;
+  // Per-frame update of an animated scene: after objects moved or deformed (e.g. MeshTriangle::Refit()), refits the
+  // BVH to them in O(n) instead of rebuilding it, and updates the emitter sampling table. The objects themselves
+  // must be the same as at BuildBVH(). A dynamic top level moves every leaf instead.
+  void RefitBVH();
+
+  // Radiance arriving along the ray, estimated by a path starting at bounce depth.
+  Vector3f CastRay(const Ray& ray, int depth, Sampler& sampler) const;
+
+  // Same, for a ray whose closest hit is already known, e.g. a camera ray traced once and reused across samples.
+  Vector3f CastRay(const Ray& ray, const Intersection& first_hit, int depth, Sampler& sampler) const;
 
-  void SampleLight(Intersection& pos, float& pdf) const;
+  // Samples a point on the emitters, uniformly over their total area: an emitter is drawn from emitter_table in
+  // O(1), then a point on it. pdf is the area density of the returned point.
+  void SampleLight(Intersection& pos, float& pdf, Sampler& sampler) const;
 
   bool Trace(const Ray& ray, const std::vector<Object*>& objects, float& t_near, uint32_t& index, Object** hit_object);
 
@@ -63,11 +97,34 @@ public:
   int height = 960;
   double fov = 40;
   Vector3f background_color = Vector3f(0.235294, 0.67451, 0.843137);
-  int max_depth = 1;
-  float russian_roulette = 0.8;
+  int max_depth = 16;             // maximum number of bounces of a path
+  float russian_roulette = 0.8;   // highest survival probability of a path in Russian roulette
+  BVHAccel::NodeLayout bvh_layout = BVHAccel::NodeLayout::kWide4;
+  BVHAccel::SplitMethod bvh_split = BVHAccel::SplitMethod::kSAH;
+  bool dynamic_top_level = false;  // for live editing: BuildBVH() makes a DynamicBvh, see Add()/Remove()/Update()
 
   // creating the scene (adding objects and lights)
   std::vector<Object*> objects;
   std::vector<std::unique_ptr<Light>> lights;
-  BVHAccel* bvh;
+  std::unique_ptr<BVHAccel> bvh;            // rebuilt by BuildBVH()
+  std::unique_ptr<DynamicBvh> dynamic_bvh;  // in place of bvh when dynamic_top_level
+  std::vector<Object*> emitters;            // objects that emit light, rebuilt by BuildBVH()
+  AliasTable emitter_table;       // emitters weighted by area
+  float emitter_area = 0;         // total area of the emitters
+
+private:
+  // Where an object is kept while the top level is dynamic: its index in objects and its leaf in dynamic_bvh
+  struct Placement {
+    int index;
+    int proxy;
+  };
+
+  // Collects the emitters and weights them by their current area
+  void BuildEmitterTable();
+
+  // Weights the current emitters by their area
+  void WeighEmitters();
+
+private:
+  std::unordered_map<Object*, Placement> placements_;
 };
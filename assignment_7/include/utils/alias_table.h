@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Walker's alias method: after an O(n) build, draws index i with probability weights[i] / sum(weights) in O(1)
+// from a single uniform number, whatever the number of entries.
+class AliasTable {
+public:
+  AliasTable() = default;
+
+  explicit AliasTable(const std::vector<float>& weights) { Build(weights); }
+
+  // Vose's construction. Zero weights are never drawn; if all weights are zero the table is empty.
+  void Build(const std::vector<float>& weights) {
+    int n = weights.size();
+    bins_.assign(n, Bin());
+    double sum = 0;
+    for (float w : weights) {
+      sum += std::max(0.f, w);
+    }
+    if (n == 0 || sum <= 0) {
+      bins_.clear();
+      return;
+    }
+
+    // Every bin holds n / sum of the total weight: its own share p * n plus, if that falls short, the excess of
+    // one heavier entry (its alias)
+    std::vector<double> scaled(n);
+    std::vector<int> under, over;
+    for (int i = 0; i < n; ++i) {
+      bins_[i].pmf = std::max(0.f, weights[i]) / sum;
+      scaled[i] = bins_[i].pmf * n;
+      (scaled[i] < 1 ? under : over).push_back(i);
+    }
+    while (!under.empty() && !over.empty()) {
+      int small = under.back();
+      int large = over.back();
+      under.pop_back();
+      bins_[small].q = scaled[small];
+      bins_[small].alias = large;
+      scaled[large] -= 1 - scaled[small];
+      if (scaled[large] < 1) {
+        over.pop_back();
+        under.push_back(large);
+      }
+    }
+    // what is left is 1 up to rounding
+    for (int i : under) {
+      bins_[i].q = 1;
+      bins_[i].alias = i;
+    }
+    for (int i : over) {
+      bins_[i].q = 1;
+      bins_[i].alias = i;
+    }
+  }
+
+  // Maps u in [0, 1) to an index and returns it together with its probability; -1 with probability 0 if the table
+  // is empty
+  int Sample(float u, float* pmf = nullptr) const {
+    int n = bins_.size();
+    if (n == 0) {
+      if (pmf)
+        *pmf = 0;
+      return -1;
+    }
+    float scaled = u * n;
+    int bin = std::min((int)scaled, n - 1);
+    // the fraction of u * n left over decides between the bin and its alias
+    float up = std::min(scaled - bin, 0x1.fffffep-1f);
+    int index = up < bins_[bin].q ? bin : bins_[bin].alias;
+    if (pmf)
+      *pmf = bins_[index].pmf;
+    return index;
+  }
+
+  float Pmf(int index) const { return bins_[index].pmf; }
+
+  int Size() const { return bins_.size(); }
+
+  bool Empty() const { return bins_.empty(); }
+
+private:
+  struct Bin {
+    float q = 0;  // probability of keeping the bin itself
+    float pmf = 0;
+    int alias = 0;
+  };
+
+  std::vector<Bin> bins_;
+};
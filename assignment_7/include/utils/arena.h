@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Monotonic block allocator: objects are carved out of large blocks one after the other and are only ever freed
+// all at once by Release() or the destructor. Their destructors are not run, so only trivially destructible types
+// may be allocated. Not thread-safe.
+class MemoryArena {
+public:
+  static constexpr size_t kHugePageSize = size_t(2) << 20;
+
+  // With huge_pages the blocks are 2 MB aligned and, on Linux, advised to be backed by transparent huge pages,
+  // which saves TLB misses when walking large structures allocated from the arena.
+  explicit MemoryArena(size_t block_size = 256 << 10, bool huge_pages = false)
+      : block_size_(huge_pages ? RoundUp(block_size, kHugePageSize) : block_size), huge_pages_(huge_pages) {}
+
+  MemoryArena(const MemoryArena&) = delete;
+  MemoryArena& operator=(const MemoryArena&) = delete;
+
+  ~MemoryArena() { Release(); }
+
+  // align may exceed alignof(std::max_align_t): the address itself is aligned, not the offset into the block
+  void* Alloc(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    size_t offset = current_ == nullptr ? 0 : AlignedOffset(current_, current_offset_, align);
+    if (current_ == nullptr || offset + bytes > current_size_) {
+      // oversized requests get a block of their own; align - 1 bytes of padding always fit in front
+      current_size_ = std::max(bytes + align, block_size_);
+      current_ = AllocBlock(current_size_);
+      blocks_.push_back(current_);
+      offset = AlignedOffset(current_, 0, align);
+    }
+    current_offset_ = offset + bytes;
+    return current_ + offset;
+  }
+
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    static_assert(std::is_trivially_destructible<T>::value, "the arena never runs destructors");
+    return new (Alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  // Frees every block; all pointers handed out become invalid.
+  void Release() {
+    for (char* block : blocks_) {
+      std::free(block);
+    }
+    blocks_.clear();
+    bytes_allocated_ = 0;
+    current_ = nullptr;
+    current_offset_ = current_size_ = 0;
+  }
+
+  // Total size of the blocks currently held
+  size_t BytesAllocated() const { return bytes_allocated_; }
+
+private:
+  static size_t RoundUp(size_t n, size_t align) { return (n + align - 1) / align * align; }
+
+  // Smallest offset from block, at least offset, whose address is a multiple of align
+  static size_t AlignedOffset(const char* block, size_t offset, size_t align) {
+    uintptr_t address = reinterpret_cast<uintptr_t>(block) + offset;
+    return RoundUp(address, align) - reinterpret_cast<uintptr_t>(block);
+  }
+
+  char* AllocBlock(size_t size) {
+    char* block;
+    if (huge_pages_) {
+      size = RoundUp(size, kHugePageSize);
+      block = static_cast<char*>(std::aligned_alloc(kHugePageSize, size));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+      if (block != nullptr)
+        madvise(block, size, MADV_HUGEPAGE);  // only a hint, failure is harmless
+#endif
+    } else {
+      block = static_cast<char*>(std::malloc(size));
+    }
+    if (block == nullptr)
+      throw std::bad_alloc();
+    bytes_allocated_ += size;
+    return block;
+  }
+
+private:
+  const size_t block_size_;
+  const bool huge_pages_;
+  std::vector<char*> blocks_;
+  char* current_ = nullptr;
+  size_t current_offset_ = 0;
+  size_t current_size_ = 0;
+  size_t bytes_allocated_ = 0;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Number of hardware threads, never less than 1.
+inline int NumSystemThreads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs fn(i) for every i in [0, count) on up to num_threads workers (0 = one per hardware thread).
+// Items are handed out one at a time through a shared atomic counter, so uneven items balance themselves.
+template <typename Fn>
+void ParallelFor(int count, Fn&& fn, int num_threads = 0) {
+  if (num_threads <= 0)
+    num_threads = NumSystemThreads();
+  num_threads = std::min(num_threads, count);
+
+  std::atomic<int> next{0};
+  auto worker = [&]() {
+    for (int i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+
+  if (num_threads <= 1) {
+    worker();
+    return;
+  }
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (int t = 1; t < num_threads; ++t) {
+    threads.emplace_back(worker);
+  }
+  worker();  // the calling thread works too
+  for (auto& t : threads) {
+    t.join();
+  }
+}
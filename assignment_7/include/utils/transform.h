@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cmath>
+
+#include "bounds3.h"
+#include "global.h"
+#include "ray.h"
+#include "utils/vector.h"
+
+// Affine transform, stored as the top three rows of its 4x4 matrix together with those of its inverse so that
+// neither direction ever needs a matrix inversion. Build transforms from the factories and compose them with *.
+class Transform {
+public:
+  // Identity
+  Transform() : Transform(kIdentity, kIdentity) {}
+
+  static Transform Translate(const Vector3f& delta) {
+    Transform t;
+    t.m_[0][3] = delta.x, t.m_[1][3] = delta.y, t.m_[2][3] = delta.z;
+    t.inv_[0][3] = -delta.x, t.inv_[1][3] = -delta.y, t.inv_[2][3] = -delta.z;
+    return t;
+  }
+
+  static Transform Scale(const Vector3f& s) {
+    Transform t;
+    t.m_[0][0] = s.x, t.m_[1][1] = s.y, t.m_[2][2] = s.z;
+    t.inv_[0][0] = 1 / s.x, t.inv_[1][1] = 1 / s.y, t.inv_[2][2] = 1 / s.z;
+    return t;
+  }
+
+  static Transform Scale(float s) { return Scale(Vector3f(s)); }
+
+  // Rotation by degrees around axis, counterclockwise looking down the axis
+  static Transform Rotate(float degrees, const Vector3f& axis) {
+    Vector3f a = Normalize(axis);
+    float s = std::sin(Deg2Rad(degrees)), c = std::cos(Deg2Rad(degrees));
+    Transform t;
+    t.m_[0][0] = a.x * a.x + (1 - a.x * a.x) * c;
+    t.m_[0][1] = a.x * a.y * (1 - c) - a.z * s;
+    t.m_[0][2] = a.x * a.z * (1 - c) + a.y * s;
+    t.m_[1][0] = a.x * a.y * (1 - c) + a.z * s;
+    t.m_[1][1] = a.y * a.y + (1 - a.y * a.y) * c;
+    t.m_[1][2] = a.y * a.z * (1 - c) - a.x * s;
+    t.m_[2][0] = a.x * a.z * (1 - c) - a.y * s;
+    t.m_[2][1] = a.y * a.z * (1 - c) + a.x * s;
+    t.m_[2][2] = a.z * a.z + (1 - a.z * a.z) * c;
+    // the inverse of a rotation is its transpose
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        t.inv_[i][j] = t.m_[j][i];
+      }
+    }
+    return t;
+  }
+
+  // Applies t first, then this
+  Transform operator*(const Transform& t) const {
+    Transform r;
+    Multiply(m_, t.m_, r.m_);
+    Multiply(t.inv_, inv_, r.inv_);
+    return r;
+  }
+
+  Transform Inverse() const { return Transform(inv_, m_); }
+
+  Vector3f Point(const Vector3f& p) const { return Apply(m_, p, 1); }
+
+  Vector3f Vector(const Vector3f& v) const { return Apply(m_, v, 0); }
+
+  // Normals transform with the inverse transpose; the result is unit length
+  Vector3f Normal(const Vector3f& n) const {
+    return Normalize(Vector3f(inv_[0][0] * n.x + inv_[1][0] * n.y + inv_[2][0] * n.z,
+                              inv_[0][1] * n.x + inv_[1][1] * n.y + inv_[2][1] * n.z,
+                              inv_[0][2] * n.x + inv_[1][2] * n.y + inv_[2][2] * n.z));
+  }
+
+  // Box around the transformed corners of b
+  Bounds3 Bounds(const Bounds3& b) const {
+    Bounds3 r;
+    for (int corner = 0; corner < 8; ++corner) {
+      r = Union(r, Point(Vector3f(corner & 1 ? b.p_max.x : b.p_min.x, corner & 2 ? b.p_max.y : b.p_min.y,
+                                  corner & 4 ? b.p_max.z : b.p_min.z)));
+    }
+    return r;
+  }
+
+  // The ray in the space this transform maps from. The direction is not renormalized, so distances along the ray
+  // (t, t_max) mean the same in both spaces.
+  Ray InverseRay(const Ray& ray) const {
+    Ray r(Apply(inv_, ray.origin, 1), Apply(inv_, ray.direction, 0), ray.t);
+    r.t_min = ray.t_min;
+    r.t_max = ray.t_max;
+    return r;
+  }
+
+private:
+  using Matrix34 = float[3][4];
+
+  static constexpr Matrix34 kIdentity = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+  Transform(const Matrix34& m, const Matrix34& inv) {
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        m_[i][j] = m[i][j];
+        inv_[i][j] = inv[i][j];
+      }
+    }
+  }
+
+  // r = a * b, the implicit bottom rows being (0, 0, 0, 1)
+  static void Multiply(const Matrix34& a, const Matrix34& b, Matrix34& r) {
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        r[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j] + (j == 3 ? a[i][3] : 0);
+      }
+    }
+  }
+
+  // w = 1 for points, 0 for vectors
+  static Vector3f Apply(const Matrix34& m, const Vector3f& v, float w) {
+    return Vector3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3] * w,
+                    m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3] * w,
+                    m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3] * w);
+  }
+
+private:
+  Matrix34 m_;    // object to world
+  Matrix34 inv_;  // world to object
+};
@@ -33,7 +33,7 @@ public:
   }
 
   double operator[](int index) const;
-  double& operator[](int index);
+  float& operator[](int index);
 
   float Norm() { return std::sqrt(x * x + y * y + z * z); }
 
@@ -61,8 +61,8 @@ inline double Vector3f::operator[](int index) const {
   return (&x)[index];
 }
 
-inline double& Vector3f::operator[](int index) {
-  return reinterpret_cast<double*>(&x)[index];
+inline float& Vector3f::operator[](int index) {
+  return (&x)[index];
 }
 
 class Vector2f {
@@ -2,145 +2,767 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <future>
+
 #include "global.h"
+#include "utils/parallel.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+constexpr int kSahBuckets = 16;
+// Cost of one node traversal step relative to one primitive intersection.
+constexpr double kTraversalCost = 0.125;
+// Same relative to one batched leaf test (TriangleBlock::IntersectLanes()). Testing the four boxes of a wide node
+// takes about half as long as a four-lane triangle test, and a wide node stands for three binary ones.
+constexpr double kBatchTraversalCost = 0.25;
+// Nodes with at least this many primitives build, or refit, their two subtrees concurrently
+constexpr int kParallelBuildThreshold = 4096;
+
+// Depth down to which a recursion over the tree hands one of its two subtrees to another thread: two tasks per
+// level until there are about twice as many tasks as threads
+int SpawnDepth() {
+  int threads = NumSystemThreads();
+  int spawn_depth = 0;
+  while (threads > 1 && (1 << spawn_depth) < 2 * threads) {
+    ++spawn_depth;
+  }
+  return spawn_depth;
+}
+
+// ParallelFor over [0, count) in chunks big enough to amortize handing out the work
+template <typename Fn>
+void ParallelForChunks(int count, Fn&& fn) {
+  constexpr int kChunk = 4096;
+  ParallelFor((count + kChunk - 1) / kChunk, [&](int chunk) {
+    int end = std::min(count, (chunk + 1) * kChunk);
+    for (int i = chunk * kChunk; i < end; ++i) {
+      fn(i);
+    }
+  });
+}
+
+// LBVH: 30-bit Morton codes, 10 bits per axis, of which the top kTreeletBits group primitives into treelets
+constexpr int kMortonBits = 30;
+constexpr int kTreeletBits = 12;
+constexpr int kRadixBitsPerPass = 10;
+constexpr int kRadixBuckets = 1 << kRadixBitsPerPass;
+
+// Spreads the low 10 bits of x so that two zero bits separate each of them
+inline uint32_t LeftShift3(uint32_t x) {
+  x = (x | (x << 16)) & 0x030000FF;
+  x = (x | (x << 8)) & 0x0300F00F;
+  x = (x | (x << 4)) & 0x030C30C3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+// Interleaves the coordinates of a point in [0, 1]^3, so bit b of the code splits along axis b % 3
+inline uint32_t EncodeMorton3(const Vector3f& offset) {
+  auto quantize = [](float f) { return (uint32_t)std::min(std::max(f * 1024.f, 0.f), 1023.f); };
+  return (LeftShift3(quantize(offset.z)) << 2) | (LeftShift3(quantize(offset.y)) << 1) | LeftShift3(quantize(offset.x));
+}
+
+// Parallel LSD radix sort by Morton code. Every pass histograms one chunk per task, turns the histograms into
+// per-chunk output offsets and scatters the chunks concurrently; chunks are ordered, so each pass is stable.
+void RadixSort(std::vector<MortonPrimitive>* v) {
+  int n = v->size();
+  int n_chunks = std::max(1, std::min(4 * NumSystemThreads(), n / 16384));
+  std::vector<MortonPrimitive> temp(n);
+  std::vector<int> offsets(n_chunks * kRadixBuckets);
+  for (int pass = 0; pass < kMortonBits / kRadixBitsPerPass; ++pass) {
+    int low_bit = pass * kRadixBitsPerPass;
+    const std::vector<MortonPrimitive>& in = (pass & 1) ? temp : *v;
+    std::vector<MortonPrimitive>& out = (pass & 1) ? *v : temp;
+    auto bucket_of = [low_bit](const MortonPrimitive& mp) { return (mp.code >> low_bit) & (kRadixBuckets - 1); };
+
+    std::fill(offsets.begin(), offsets.end(), 0);
+    ParallelFor(n_chunks, [&](int c) {
+      int* count = &offsets[c * kRadixBuckets];
+      for (int i = (int64_t)n * c / n_chunks; i < (int64_t)n * (c + 1) / n_chunks; ++i) {
+        count[bucket_of(in[i])]++;
+      }
+    });
+    int sum = 0;
+    for (int b = 0; b < kRadixBuckets; ++b) {
+      for (int c = 0; c < n_chunks; ++c) {
+        int count = offsets[c * kRadixBuckets + b];
+        offsets[c * kRadixBuckets + b] = sum;
+        sum += count;
+      }
+    }
+    ParallelFor(n_chunks, [&](int c) {
+      int* offset = &offsets[c * kRadixBuckets];
+      for (int i = (int64_t)n * c / n_chunks; i < (int64_t)n * (c + 1) / n_chunks; ++i) {
+        out[offset[bucket_of(in[i])]++] = in[i];
+      }
+    });
+  }
+  // an odd number of passes leaves the result in temp
+  if ((kMortonBits / kRadixBitsPerPass) & 1)
+    v->swap(temp);
+}
+
+// Slab test of a ray against the four child boxes of a wide node, restricted to [0, t_max].
+// Returns a bit mask of the children hit and stores their entry distances in t_near.
+inline int IntersectChildren(const Bvh4Node& node, const Ray& ray, const Vector3f& inv_dir, const int dir_is_neg[3],
+                             float t_max, float t_near[4]) {
+#if defined(__SSE__)
+  __m128 t0 = _mm_setzero_ps();
+  __m128 t1 = _mm_set1_ps(t_max);
+  for (int axis = 0; axis < 3; ++axis) {
+    __m128 org = _mm_set1_ps(ray.origin[axis]);
+    __m128 inv = _mm_set1_ps(inv_dir[axis]);
+    __m128 t_axis_min = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[dir_is_neg[axis]][axis]), org), inv);
+    __m128 t_axis_max = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1 - dir_is_neg[axis]][axis]), org), inv);
+    // min/max return their second operand when the first is NaN, so NaN slabs are ignored
+    t0 = _mm_max_ps(t_axis_min, t0);
+    t1 = _mm_min_ps(t_axis_max, t1);
+  }
+  _mm_storeu_ps(t_near, t0);
+  return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+  int mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    float t0 = 0, t1 = t_max;
+    for (int axis = 0; axis < 3; ++axis) {
+      float t_axis_min = (node.bounds[dir_is_neg[axis]][axis][i] - ray.origin[axis]) * inv_dir[axis];
+      float t_axis_max = (node.bounds[1 - dir_is_neg[axis]][axis][i] - ray.origin[axis]) * inv_dir[axis];
+      if (t_axis_min > t0)
+        t0 = t_axis_min;
+      if (t_axis_max < t1)
+        t1 = t_axis_max;
+    }
+    t_near[i] = t0;
+    mask |= (t0 <= t1) << i;
+  }
+  return mask;
+#endif
+}
+
+// Entry of the wide traversal stack: a wide node, or a leaf range when n_primitives > 0
+struct WideStackEntry {
+  int child;
+  int n_primitives;
+  float t_near;
+};
 
-BVHAccel::BVHAccel(std::vector<Object*> p, int max_prims_in_node, SplitMethod split_method)
-    : max_prims_in_node_(std::min(255, max_prims_in_node)), split_method_(split_method), primitives_(std::move(p)) {
-  time_t start, stop;
-  time(&start);
-  if (primitives_.empty())
+// Pushes the children selected by mask so that the nearest one ends up on top of the stack.
+inline void PushChildren(const Bvh4Node& node, int mask, const float t_near[4], WideStackEntry* stack, int& sp) {
+  WideStackEntry hits[4];
+  int n_hits = 0;
+  for (int i = 0; i < 4; ++i) {
+    if (!(mask & (1 << i)))
+      continue;
+    // insertion sort, farthest first
+    int k = n_hits++;
+    while (k > 0 && hits[k - 1].t_near < t_near[i]) {
+      hits[k] = hits[k - 1];
+      --k;
+    }
+    hits[k] = {node.child[i], node.n_primitives[i], t_near[i]};
+  }
+  for (int k = 0; k < n_hits; ++k) {
+    stack[sp++] = hits[k];
+  }
+}
+
+}  // namespace
+
+const char* SplitMethodName(BVHAccel::SplitMethod split_method) {
+  switch (split_method) {
+    case BVHAccel::SplitMethod::kNaive:
+      return "Naive";
+    case BVHAccel::SplitMethod::kSAH:
+      return "SAH";
+    case BVHAccel::SplitMethod::kLBVH:
+      return "LBVH";
+  }
+  return "";
+}
+
+BVHAccel::BVHAccel(std::vector<Object*> p, int max_prims_in_node, SplitMethod split_method, NodeLayout layout)
+    : max_prims_in_node_(std::min(255, max_prims_in_node)),
+      split_method_(split_method),
+      layout_(layout),
+      leaf_batch_(1),
+      traversal_cost_(kTraversalCost),
+      primitives_(std::move(p)) {
+  std::vector<BvhPrimitiveInfo> infos(primitives_.size());
+  ParallelForChunks(infos.size(), [&](int i) { infos[i] = BvhPrimitiveInfo(i, primitives_[i]->GetBounds()); });
+  Build(std::move(infos));
+}
+
+BVHAccel::BVHAccel(const std::vector<Bounds3>& prim_bounds, int max_prims_in_node, SplitMethod split_method,
+                   NodeLayout layout, int leaf_batch)
+    : max_prims_in_node_(std::min(255, max_prims_in_node)),
+      split_method_(split_method),
+      layout_(layout),
+      leaf_batch_(std::max(1, leaf_batch)),
+      traversal_cost_(leaf_batch > 1 ? kBatchTraversalCost : kTraversalCost) {
+  std::vector<BvhPrimitiveInfo> infos(prim_bounds.size());
+  ParallelForChunks(infos.size(), [&](int i) { infos[i] = BvhPrimitiveInfo(i, prim_bounds[i]); });
+  Build(std::move(infos));
+}
+
+BVHAccel::~BVHAccel() = default;
+
+void BVHAccel::Build(std::vector<BvhPrimitiveInfo> infos) {
+  auto start = std::chrono::steady_clock::now();
+  if (infos.empty())
     return;
 
-  root = RecursiveBuild(primitives_);
+  // Up to 2n - 1 nodes, reserved up front so that build tasks take them by bumping an index; big trees get huge
+  // pages, which are only backed by memory once touched
+  max_nodes_ = 2 * infos.size() - 1;
+  size_t max_node_bytes = max_nodes_ * sizeof(BvhNode);
+  bool huge_pages = max_node_bytes >= 4 * MemoryArena::kHugePageSize;
+  node_arena_ = std::make_unique<MemoryArena>(max_node_bytes, huge_pages);
+  node_block_ = static_cast<BvhNode*>(node_arena_->Alloc(max_node_bytes, alignof(BvhNode)));
+  next_node_.store(0, std::memory_order_relaxed);
+
+  if (split_method_ == SplitMethod::kLBVH) {
+    root = LbvhBuild(infos);
+  } else {
+    root = RecursiveBuild(infos, 0, infos.size(), SpawnDepth());
+  }
+
+  // The build partitions in place, so infos now lists the primitives in leaf order
+  prim_order_.resize(infos.size());
+  for (size_t i = 0; i < infos.size(); ++i) {
+    prim_order_[i] = infos[i].prim_number;
+  }
+  if (!primitives_.empty()) {
+    std::vector<Object*> ordered_prims(primitives_.size());
+    for (size_t i = 0; i < prim_order_.size(); ++i) {
+      ordered_prims[i] = primitives_[prim_order_[i]];
+    }
+    primitives_.swap(ordered_prims);
+  }
+
+  if (layout_ == NodeLayout::kWide4) {
+    wide_nodes_.clear();
+    CollapseWide(root);
+  } else {
+    int total_nodes = CountNodes(root);
+    nodes_.resize(total_nodes);
+    int offset = 0;
+    FlattenBvhTree(root, &offset);
+    assert(offset == total_nodes);
+  }
 
-  time(&stop);
-  double diff = difftime(stop, start);
+  double diff = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
   int hrs = (int)diff / 3600;
   int mins = ((int)diff / 60) - (hrs * 60);
-  int secs = (int)diff - (hrs * 3600) - (mins * 60);
+  double secs = diff - (hrs * 3600) - (mins * 60);
 
-  printf("\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n", hrs, mins, secs);
+  printf("\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %.3f secs\n", hrs, mins, secs);
+  build_sah_cost_ = SahCost();
+  printf("Primitives: %zu, SAH cost: %.3f (%s, %s)\n\n", prim_order_.size(), build_sah_cost_,
+         SplitMethodName(split_method_), layout_ == NodeLayout::kWide4 ? "wide4" : "binary");
 }
 
 // BVH 构建流程
-BvhNode* BVHAccel::RecursiveBuild(std::vector<Object*> objects) {
-  BvhNode* node = new BvhNode();
+BvhNode* BVHAccel::RecursiveBuild(std::vector<BvhPrimitiveInfo>& infos, int start, int end, int spawn_depth) {
+  BvhNode* node = NewNode();
+  int n = end - start;
 
   // Compute bounds of all primitives in BVH node
   Bounds3 bounds;
-  for (int i = 0; i < objects.size(); ++i) {
-    bounds = Union(bounds, objects[i]->GetBounds());
+  Bounds3 centroid_bounds;
+  for (int i = start; i < end; ++i) {
+    bounds = Union(bounds, infos[i].bounds);
+    centroid_bounds = Union(centroid_bounds, infos[i].centroid);
   }
 
-  // clang-format off
-  // 基准情况： 只有1个物体 → 创建叶子节点
-  if (objects.size() == 1) {
-    node->bounds = objects[0]->GetBounds();
-    node->object = objects[0];
-    node->left = nullptr;
-    node->right = nullptr;
-    node->area = objects[0]->GetArea();
-    return node;
+  // 基准情况： 物体足够少 → 创建叶子节点 (SAH decides for itself whether small nodes pay off)
+  if (n == 1 || (split_method_ == SplitMethod::kNaive && n <= max_prims_in_node_)) {
+    return CreateLeaf(node, infos, start, end);
   }
-  // 两个物体 → 直接分开
-  else if (objects.size() == 2) {
-    node->left = RecursiveBuild(std::vector{objects[0]});
-    node->right = RecursiveBuild(std::vector{objects[1]});
 
-    node->bounds = Union(node->left->bounds, node->right->bounds);
-    node->area = node->left->area + node->right->area;
-    return node;
-  }
-  // 多个物体 → 选择最长轴分割
-  else {
-    Bounds3 centroid_bounds;
-    for (int i = 0; i < objects.size(); ++i)
-      centroid_bounds = Union(centroid_bounds, objects[i]->GetBounds().Centroid());
-    int dim = centroid_bounds.MaxExtent();  // 最长轴
-    // 按最长轴排序
-    switch (dim) {
-      case 0:
-        std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-          return f1->GetBounds().Centroid().x < f2->GetBounds().Centroid().x;
-        });
-        break;
-      case 1:
-        std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-          return f1->GetBounds().Centroid().y < f2->GetBounds().Centroid().y;
-        });
-        break;
-      case 2:
-        std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-          return f1->GetBounds().Centroid().z < f2->GetBounds().Centroid().z;
-        });
-        break;
+  int dim = centroid_bounds.MaxExtent();  // 最长轴
+  int mid;
+  bool degenerate = centroid_bounds.p_max[dim] == centroid_bounds.p_min[dim];
+  if (split_method_ == SplitMethod::kSAH && !degenerate) {
+    if (!SplitSAH(infos, start, end, bounds, centroid_bounds, dim, &mid)) {
+      return CreateLeaf(node, infos, start, end);
     }
-    // clang-format on
+  } else {
+    // 按最长轴取中位数分割; all centroids coincide → split by count so that leaves stay small
+    mid = start + n / 2;
+    std::nth_element(infos.begin() + start, infos.begin() + mid, infos.begin() + end,
+                     [dim](const auto& a, const auto& b) { return a.centroid[dim] < b.centroid[dim]; });
+  }
 
-    auto beginning = objects.begin();
-    auto middling = objects.begin() + (objects.size() / 2);
-    auto ending = objects.end();
+  assert(start < mid && mid < end);
 
-    auto left_shapes = std::vector<Object*>(beginning, middling);
-    auto right_shapes = std::vector<Object*>(middling, ending);
+  node->split_axis = dim;
+  if (spawn_depth > 0 && n >= kParallelBuildThreshold) {
+    // the two halves touch disjoint ranges of infos, so the left one can be built on another thread
+    auto left = std::async(std::launch::async, [&]() { return RecursiveBuild(infos, start, mid, spawn_depth - 1); });
+    node->right = RecursiveBuild(infos, mid, end, spawn_depth - 1);
+    node->left = left.get();
+  } else {
+    node->left = RecursiveBuild(infos, start, mid, 0);
+    node->right = RecursiveBuild(infos, mid, end, 0);
+  }
 
-    assert(objects.size() == (left_shapes.size() + right_shapes.size()));
+  node->bounds = Union(node->left->bounds, node->right->bounds);
+  node->subtree_primitives = node->left->subtree_primitives + node->right->subtree_primitives;
+  return node;
+}
 
-    node->left = RecursiveBuild(left_shapes);
-    node->right = RecursiveBuild(right_shapes);
+BvhNode* BVHAccel::NewNode() {
+  int index = next_node_.fetch_add(1, std::memory_order_relaxed);
+  assert(index < max_nodes_);
+  return new (&node_block_[index]) BvhNode();
+}
 
-    node->bounds = Union(node->left->bounds, node->right->bounds);
-    node->area = node->left->area + node->right->area;
+BvhNode* BVHAccel::CreateLeaf(BvhNode* node, const std::vector<BvhPrimitiveInfo>& infos, int start, int end) {
+  node->first_prim_offset = start;
+  node->n_primitives = end - start;
+  node->subtree_primitives = end - start;
+  for (int i = start; i < end; ++i) {
+    node->bounds = Union(node->bounds, infos[i].bounds);
+  }
+  node->left = nullptr;
+  node->right = nullptr;
+  return node;
+}
+
+bool BVHAccel::SplitSAH(std::vector<BvhPrimitiveInfo>& infos, int start, int end, const Bounds3& bounds,
+                        const Bounds3& centroid_bounds, int dim, int* mid) const {
+  auto bucket_of = [&](const BvhPrimitiveInfo& info) {
+    int b = kSahBuckets * centroid_bounds.Offset(info.centroid)[dim];
+    return std::min(b, kSahBuckets - 1);
+  };
+
+  // Project the centroids into buckets along the split axis
+  int counts[kSahBuckets] = {};
+  Bounds3 bucket_bounds[kSahBuckets];
+  for (int i = start; i < end; ++i) {
+    int b = bucket_of(infos[i]);
+    counts[b]++;
+    bucket_bounds[b] = Union(bucket_bounds[b], infos[i].bounds);
+  }
+
+  // Sweep from both sides so the cost of all kSahBuckets - 1 split planes is known in linear time:
+  // cost(i) = trav + (leaf(N_left) * SA(left) + leaf(N_right) * SA(right)) / SA(node)
+  double cost[kSahBuckets - 1];
+  Bounds3 acc;
+  int n_acc = 0;
+  for (int i = 0; i < kSahBuckets - 1; ++i) {
+    acc = Union(acc, bucket_bounds[i]);
+    n_acc += counts[i];
+    cost[i] = n_acc ? LeafCost(n_acc) * acc.SurfaceArea() : 0;
+  }
+  acc = Bounds3();
+  n_acc = 0;
+  for (int i = kSahBuckets - 1; i > 0; --i) {
+    acc = Union(acc, bucket_bounds[i]);
+    n_acc += counts[i];
+    cost[i - 1] += n_acc ? LeafCost(n_acc) * acc.SurfaceArea() : 0;
+  }
+
+  int min_bucket = 0;
+  for (int i = 1; i < kSahBuckets - 1; ++i) {
+    if (cost[i] < cost[min_bucket])
+      min_bucket = i;
+  }
+  double min_cost = traversal_cost_ + cost[min_bucket] / bounds.SurfaceArea();
+
+  // Stop when intersecting everything here is cheaper than splitting, as long as the leaf fits
+  int n = end - start;
+  double leaf_cost = LeafCost(n);
+  if (n <= max_prims_in_node_ && leaf_cost <= min_cost)
+    return false;
+
+  auto middle = std::partition(infos.begin() + start, infos.begin() + end,
+                               [&](const BvhPrimitiveInfo& info) { return bucket_of(info) <= min_bucket; });
+  *mid = middle - infos.begin();
+  return true;
+}
+
+BvhNode* BVHAccel::LbvhBuild(std::vector<BvhPrimitiveInfo>& infos) {
+  int n = infos.size();
+  Bounds3 centroid_bounds;
+  for (const auto& info : infos) {
+    centroid_bounds = Union(centroid_bounds, info.centroid);
+  }
+
+  std::vector<MortonPrimitive> morton(n);
+  ParallelForChunks(n, [&](int i) { morton[i] = {i, EncodeMorton3(centroid_bounds.Offset(infos[i].centroid))}; });
+  RadixSort(&morton);
+
+  // Store the infos in Morton order; every subtree below then covers a contiguous range of them
+  std::vector<BvhPrimitiveInfo> sorted_infos(n);
+  ParallelForChunks(n, [&](int i) { sorted_infos[i] = infos[morton[i].info_index]; });
+  infos.swap(sorted_infos);
+
+  // Primitives sharing the top kTreeletBits of their code form a treelet, each emitted by its own task
+  constexpr uint32_t kTreeletMask = ((1u << kTreeletBits) - 1) << (kMortonBits - kTreeletBits);
+  std::vector<std::pair<int, int>> treelet_ranges;
+  for (int start = 0, end = 1; end <= n; ++end) {
+    if (end == n || (morton[start].code & kTreeletMask) != (morton[end].code & kTreeletMask)) {
+      treelet_ranges.emplace_back(start, end);
+      start = end;
+    }
+  }
+  std::vector<BvhNode*> treelets(treelet_ranges.size());
+  ParallelFor(treelets.size(), [&](int t) {
+    treelets[t] = EmitLbvh(infos, morton, treelet_ranges[t].first, treelet_ranges[t].second,
+                           kMortonBits - kTreeletBits - 1);
+  });
+
+  // Join the treelets with SAH, which matters most near the root
+  std::vector<BvhPrimitiveInfo> treelet_infos(treelets.size());
+  for (size_t t = 0; t < treelets.size(); ++t) {
+    treelet_infos[t] = BvhPrimitiveInfo(t, treelets[t]->bounds);
+  }
+  return BuildUpperSah(treelets, treelet_infos, 0, treelets.size());
+}
+
+BvhNode* BVHAccel::EmitLbvh(const std::vector<BvhPrimitiveInfo>& infos, const std::vector<MortonPrimitive>& morton,
+                            int start, int end, int bit) {
+  int n = end - start;
+  if (n <= max_prims_in_node_) {
+    return CreateLeaf(NewNode(), infos, start, end);
+  }
+
+  // Skip bits on which the whole range agrees; the codes are sorted, so comparing the ends suffices
+  while (bit >= 0 && (morton[start].code & (1u << bit)) == (morton[end - 1].code & (1u << bit))) {
+    --bit;
+  }
+  int mid;
+  if (bit >= 0) {
+    uint32_t mask = 1u << bit;
+    mid = std::partition_point(morton.begin() + start, morton.begin() + end,
+                               [mask](const MortonPrimitive& mp) { return !(mp.code & mask); }) -
+          morton.begin();
+  } else {
+    // identical codes, split by count
+    mid = start + n / 2;
+  }
+
+  BvhNode* node = NewNode();
+  node->split_axis = bit >= 0 ? bit % 3 : 0;
+  node->left = EmitLbvh(infos, morton, start, mid, bit - 1);
+  node->right = EmitLbvh(infos, morton, mid, end, bit - 1);
+  node->bounds = Union(node->left->bounds, node->right->bounds);
+  node->subtree_primitives = node->left->subtree_primitives + node->right->subtree_primitives;
+  return node;
+}
+
+BvhNode* BVHAccel::BuildUpperSah(const std::vector<BvhNode*>& treelets, std::vector<BvhPrimitiveInfo>& infos,
+                                 int start, int end) {
+  if (end - start == 1)
+    return treelets[infos[start].prim_number];
+
+  Bounds3 bounds;
+  Bounds3 centroid_bounds;
+  for (int i = start; i < end; ++i) {
+    bounds = Union(bounds, infos[i].bounds);
+    centroid_bounds = Union(centroid_bounds, infos[i].centroid);
+  }
+  int dim = centroid_bounds.MaxExtent();
+  int mid;
+  bool degenerate = centroid_bounds.p_max[dim] == centroid_bounds.p_min[dim];
+  if (degenerate || !SplitSAH(infos, start, end, bounds, centroid_bounds, dim, &mid)) {
+    // a treelet cannot join a leaf, so split where SAH would rather stop
+    mid = start + (end - start) / 2;
+    std::nth_element(infos.begin() + start, infos.begin() + mid, infos.begin() + end,
+                     [dim](const auto& a, const auto& b) { return a.centroid[dim] < b.centroid[dim]; });
   }
 
+  BvhNode* node = NewNode();
+  node->split_axis = dim;
+  node->left = BuildUpperSah(treelets, infos, start, mid);
+  node->right = BuildUpperSah(treelets, infos, mid, end);
+  node->bounds = Union(node->left->bounds, node->right->bounds);
+  node->subtree_primitives = node->left->subtree_primitives + node->right->subtree_primitives;
   return node;
 }
 
+int BVHAccel::CountNodes(const BvhNode* node) const {
+  if (node->left == nullptr && node->right == nullptr)
+    return 1;
+  return 1 + CountNodes(node->left) + CountNodes(node->right);
+}
+
+Bounds3 BVHAccel::WorldBound() const {
+  return root ? root->bounds : Bounds3();
+}
+
+double BVHAccel::SahCost() const {
+  if (!root)
+    return 0;
+  return SahCost(root) / root->bounds.SurfaceArea();
+}
+
+double BVHAccel::SahCost(const BvhNode* node) const {
+  double area = node->bounds.SurfaceArea();
+  if (node->left == nullptr && node->right == nullptr)
+    return area * LeafCost(node->n_primitives);
+  return area * traversal_cost_ + SahCost(node->left) + SahCost(node->right);
+}
+
+bool BVHAccel::Refit(double max_sah_growth) {
+  std::vector<Bounds3> prim_bounds(primitives_.size());
+  ParallelForChunks(prim_bounds.size(), [&](int i) { prim_bounds[i] = primitives_[i]->GetBounds(); });
+  return Refit(prim_bounds, max_sah_growth);
+}
+
+bool BVHAccel::Refit(const std::vector<Bounds3>& prim_bounds, double max_sah_growth) {
+  if (!root)
+    return false;
+  assert(prim_bounds.size() == prim_order_.size());
+  double cost = RefitNode(root, prim_bounds, SpawnDepth()) / root->bounds.SurfaceArea();
+  if (!(cost > max_sah_growth * build_sah_cost_))
+    return false;
+
+  // The topology no longer fits the primitives; rebuild with leaf slots as the primitive numbers
+  std::vector<BvhPrimitiveInfo> infos(prim_bounds.size());
+  ParallelForChunks(infos.size(), [&](int i) { infos[i] = BvhPrimitiveInfo(i, prim_bounds[i]); });
+  Build(std::move(infos));
+  return true;
+}
+
+double BVHAccel::RefitNode(BvhNode* node, const std::vector<Bounds3>& prim_bounds, int spawn_depth) {
+  double cost;
+  if (node->left == nullptr && node->right == nullptr) {
+    Bounds3 bounds;
+    for (int i = node->first_prim_offset; i < node->first_prim_offset + node->n_primitives; ++i) {
+      bounds = Union(bounds, prim_bounds[i]);
+    }
+    node->bounds = bounds;
+    cost = bounds.SurfaceArea() * LeafCost(node->n_primitives);
+  } else {
+    double left_cost, right_cost;
+    if (spawn_depth > 0 && node->subtree_primitives >= kParallelBuildThreshold) {
+      // the subtrees share no nodes, and their layout entries are distinct too
+      auto left = std::async(std::launch::async,
+                             [&]() { return RefitNode(node->left, prim_bounds, spawn_depth - 1); });
+      right_cost = RefitNode(node->right, prim_bounds, spawn_depth - 1);
+      left_cost = left.get();
+    } else {
+      left_cost = RefitNode(node->left, prim_bounds, 0);
+      right_cost = RefitNode(node->right, prim_bounds, 0);
+    }
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    cost = node->bounds.SurfaceArea() * traversal_cost_ + left_cost + right_cost;
+  }
+
+  if (node->layout_index >= 0) {
+    if (layout_ == NodeLayout::kWide4) {
+      Bvh4Node& wide_node = wide_nodes_[node->layout_index];
+      for (int axis = 0; axis < 3; ++axis) {
+        wide_node.bounds[0][axis][node->layout_slot] = node->bounds.p_min[axis];
+        wide_node.bounds[1][axis][node->layout_slot] = node->bounds.p_max[axis];
+      }
+    } else {
+      nodes_[node->layout_index].bounds = node->bounds;
+    }
+  }
+  return cost;
+}
+
 Intersection BVHAccel::Intersect(const Ray& ray) const {
   Intersection hit;
-  if (!root)
-    return hit;
-  hit = BVHAccel::GetIntersection(root, ray);
+  // The ray is narrowed to the closest hit so far, so nested BVHs of the primitives cull against it too
+  Ray clipped = ray;
+  Traverse<false>(ray, [&](int first, int count, float& t_max) {
+    bool found = false;
+    for (int i = first; i < first + count; ++i) {
+      Intersection prim_hit = primitives_[i]->GetIntersection(clipped);
+      if (prim_hit.happened && prim_hit.distance < t_max) {
+        hit = prim_hit;
+        t_max = hit.distance;
+        clipped.t_max = hit.distance;
+        found = true;
+      }
+    }
+    return found;
+  });
   return hit;
 }
 
-Intersection BVHAccel::GetIntersection(BvhNode* node, const Ray& ray) const {
-  Intersection hit;
+bool BVHAccel::IntersectP(const Ray& ray) const {
+  return Traverse<true>(ray, [&](int first, int count, float&) {
+    for (int i = first; i < first + count; ++i) {
+      // any occluder will do, no need to find the closest one
+      if (primitives_[i]->Intersect(ray))
+        return true;
+    }
+    return false;
+  });
+}
 
-  Vector3f inv_dir = ray.direction_inv;
-  std::array<bool, 3> is_dir_neg = {ray.direction.x < 0, ray.direction.y < 0, ray.direction.z < 0};
+bool BVHAccel::Intersect(const Ray& ray, LeafIntersector& leaves) const {
+  return Traverse<false>(
+      ray, [&](int first, int count, float& t_max) { return leaves.Intersect(ray, first, count, t_max); });
+}
 
-  // Check current bbox (Bounding Box)
-  if (!node->bounds.IntersectP(ray, inv_dir, is_dir_neg)) {
-    return hit;
-  }
+bool BVHAccel::IntersectP(const Ray& ray, LeafIntersector& leaves) const {
+  return Traverse<true>(
+      ray, [&](int first, int count, float& t_max) { return leaves.IntersectP(ray, first, count, t_max); });
+}
 
-  // Check leaf node
-  if (node->left == nullptr && node->right == nullptr) {
-    return node->object->GetIntersection(ray);
+template <bool kAnyHit, typename LeafFn>
+bool BVHAccel::Traverse(const Ray& ray, LeafFn&& leaf) const {
+  return layout_ == NodeLayout::kWide4 ? TraverseWide<kAnyHit>(ray, leaf) : TraverseBinary<kAnyHit>(ray, leaf);
+}
+
+template <bool kAnyHit, typename LeafFn>
+bool BVHAccel::TraverseBinary(const Ray& ray, LeafFn&& leaf) const {
+  if (nodes_.empty())
+    return false;
+
+  bool found = false;
+  const Vector3f& inv_dir = ray.direction_inv;
+  int dir_is_neg[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+  float t_max = std::min(ray.t_max, (double)kInfinity);
+
+  // Follow the near child first and keep the far one on the stack.
+  // t_max shrinks with every hit, so boxes beyond the closest hit fail the slab test.
+  int to_visit[64];
+  int to_visit_offset = 0;
+  int current = 0;
+  while (true) {
+    const LinearBvhNode& node = nodes_[current];
+    if (node.bounds.IntersectP(ray, inv_dir, dir_is_neg, t_max)) {
+      if (node.n_primitives > 0) {
+        if (leaf(node.primitives_offset, node.n_primitives, t_max)) {
+          found = true;
+          if (kAnyHit)
+            return true;
+        }
+        if (to_visit_offset == 0)
+          break;
+        current = to_visit[--to_visit_offset];
+      } else if (dir_is_neg[node.axis]) {
+        to_visit[to_visit_offset++] = current + 1;
+        current = node.second_child_offset;
+      } else {
+        to_visit[to_visit_offset++] = node.second_child_offset;
+        current = current + 1;
+      }
+    } else {
+      if (to_visit_offset == 0)
+        break;
+      current = to_visit[--to_visit_offset];
+    }
   }
+  return found;
+}
 
-  // Recursively check left and right subtrees, return the closer hit
-  Intersection hit_left = GetIntersection(node->left, ray);
-  Intersection hit_right = GetIntersection(node->right, ray);
+template <bool kAnyHit, typename LeafFn>
+bool BVHAccel::TraverseWide(const Ray& ray, LeafFn&& leaf) const {
+  if (wide_nodes_.empty())
+    return false;
 
-  return hit_left.distance < hit_right.distance ? hit_left : hit_right;
+  bool found = false;
+  const Vector3f& inv_dir = ray.direction_inv;
+  int dir_is_neg[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+  float t_max = std::min(ray.t_max, (double)kInfinity);
+
+  // every node pops one entry and pushes at most four, so 3 * depth + 1 entries suffice
+  WideStackEntry stack[256];
+  int sp = 0;
+  stack[sp++] = {0, 0, 0.f};
+  while (sp > 0) {
+    WideStackEntry entry = stack[--sp];
+    if (entry.t_near > t_max)
+      continue;  // a closer hit was found after this entry was pushed
+    if (entry.n_primitives > 0) {
+      if (leaf(entry.child, entry.n_primitives, t_max)) {
+        found = true;
+        if (kAnyHit)
+          return true;
+      }
+      continue;
+    }
+    const Bvh4Node& node = wide_nodes_[entry.child];
+    float t_near[4];
+    int mask = IntersectChildren(node, ray, inv_dir, dir_is_neg, t_max, t_near);
+    PushChildren(node, mask, t_near, stack, sp);
+  }
+  return found;
 }
 
-void BVHAccel::GetSample(BvhNode* node, float p, Intersection& pos, float& pdf) {
-  if (node->left == nullptr || node->right == nullptr) {
-    node->object->Sample(pos, pdf);
-    pdf *= node->area;
-    return;
+int BVHAccel::CollapseWide(BvhNode* node) {
+  // Gather up to four descendants by repeatedly opening the interior child with the largest surface area
+  BvhNode* children[4] = {node};
+  int n_children = 1;
+  if (node->left != nullptr && node->right != nullptr) {
+    children[0] = node->left;
+    children[1] = node->right;
+    n_children = 2;
+  }
+  while (n_children < 4) {
+    int best = -1;
+    double best_area = -1;
+    for (int i = 0; i < n_children; ++i) {
+      BvhNode* c = children[i];
+      if (c->left != nullptr && c->right != nullptr && c->bounds.SurfaceArea() > best_area) {
+        best = i;
+        best_area = c->bounds.SurfaceArea();
+      }
+    }
+    if (best < 0)
+      break;
+    BvhNode* opened = children[best];
+    children[best] = opened->left;
+    children[n_children++] = opened->right;
   }
-  if (p < node->left->area)
-    GetSample(node->left, p, pos, pdf);
-  else
-    GetSample(node->right, p - node->left->area, pos, pdf);
+
+  int index = wide_nodes_.size();
+  wide_nodes_.emplace_back();
+  for (int i = 0; i < 4; ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      wide_nodes_[index].bounds[0][axis][i] = kInfinity;
+      wide_nodes_[index].bounds[1][axis][i] = -kInfinity;
+    }
+    wide_nodes_[index].child[i] = 0;
+    wide_nodes_[index].n_primitives[i] = 0;
+  }
+
+  for (int i = 0; i < n_children; ++i) {
+    BvhNode* c = children[i];
+    c->layout_index = index;
+    c->layout_slot = i;
+    for (int axis = 0; axis < 3; ++axis) {
+      wide_nodes_[index].bounds[0][axis][i] = c->bounds.p_min[axis];
+      wide_nodes_[index].bounds[1][axis][i] = c->bounds.p_max[axis];
+    }
+    if (c->left == nullptr && c->right == nullptr) {
+      wide_nodes_[index].child[i] = c->first_prim_offset;
+      wide_nodes_[index].n_primitives[i] = c->n_primitives;
+    } else {
+      // wide_nodes_ may grow during the recursion, so write through the index
+      int child_index = CollapseWide(c);
+      wide_nodes_[index].child[i] = child_index;
+    }
+  }
+  return index;
 }
 
-void BVHAccel::Sample(Intersection& pos, float& pdf) {
-  float p = std::sqrt(GetRandomFloat()) * root->area;
-  GetSample(root, p, pos, pdf);
-  pdf /= root->area;
+int BVHAccel::FlattenBvhTree(BvhNode* node, int* offset) {
+  LinearBvhNode& linear_node = nodes_[*offset];
+  linear_node.bounds = node->bounds;
+  int node_offset = (*offset)++;
+  node->layout_index = node_offset;
+  if (node->left == nullptr && node->right == nullptr) {
+    linear_node.primitives_offset = node->first_prim_offset;
+    linear_node.n_primitives = node->n_primitives;
+  } else {
+    linear_node.axis = node->split_axis;
+    linear_node.n_primitives = 0;
+    FlattenBvhTree(node->left, offset);
+    linear_node.second_child_offset = FlattenBvhTree(node->right, offset);
+  }
+  return node_offset;
 }
@@ -0,0 +1,155 @@
+#include "denoiser.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils/parallel.h"
+
+namespace {
+
+// 1D B3 spline kernel, the 5x5 kernel is its outer product
+constexpr float kKernel[5] = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+
+// Albedo channels below this are not divided out, there is no illumination left to recover from them
+constexpr float kMinAlbedo = 1e-3f;
+
+// A buffer of width * height floats per channel
+struct Planes {
+  Planes(int channels, size_t size) : data(channels, std::vector<float>(size)) {}
+
+  float* operator[](int channel) { return data[channel].data(); }
+
+  const float* operator[](int channel) const { return data[channel].data(); }
+
+  std::vector<std::vector<float>> data;
+};
+
+// One row of every plane the edge-stopping functions read
+struct Rows {
+  Rows(const Planes& color, const Planes& normal, const Planes& albedo, const std::vector<float>& depth, size_t row)
+      : r(color[0] + row), g(color[1] + row), b(color[2] + row), nx(normal[0] + row), ny(normal[1] + row),
+        nz(normal[2] + row), ar(albedo[0] + row), ag(albedo[1] + row), ab(albedo[2] + row), z(depth.data() + row) {}
+
+  const float *r, *g, *b;
+  const float *nx, *ny, *nz;
+  const float *ar, *ag, *ab;
+  const float* z;
+};
+
+// Inverse squared sigmas of one iteration
+struct EdgeStops {
+  float color, normal, depth, albedo;
+};
+
+// exponent[x] = -log of the edge-stopping weight between pixel x of c and its tap x + offset in t, for x in
+// [x0, x1). The outputs are __restrict so the loops vectorize without a run-time alias check against every input
+// row, which is more than GCC is willing to emit.
+void EdgeExponents(const Rows& c, const Rows& t, int offset, int x0, int x1, const EdgeStops& inv,
+                   float* __restrict exponent) {
+  for (int x = x0; x < x1; ++x) {
+    const int q = x + offset;
+    float d_color = (c.r[x] - t.r[q]) * (c.r[x] - t.r[q]) + (c.g[x] - t.g[q]) * (c.g[x] - t.g[q]) +
+                    (c.b[x] - t.b[q]) * (c.b[x] - t.b[q]);
+    float d_normal = (c.nx[x] - t.nx[q]) * (c.nx[x] - t.nx[q]) + (c.ny[x] - t.ny[q]) * (c.ny[x] - t.ny[q]) +
+                     (c.nz[x] - t.nz[q]) * (c.nz[x] - t.nz[q]);
+    float d_albedo = (c.ar[x] - t.ar[q]) * (c.ar[x] - t.ar[q]) + (c.ag[x] - t.ag[q]) * (c.ag[x] - t.ag[q]) +
+                     (c.ab[x] - t.ab[q]) * (c.ab[x] - t.ab[q]);
+    float d_z = (c.z[x] - t.z[q]) / c.z[x];
+    exponent[x] = d_color * inv.color + d_normal * inv.normal + d_z * d_z * inv.depth + d_albedo * inv.albedo;
+  }
+}
+
+// Adds weight[x] times the color of tap x + offset in t to the sums, for x in [x0, x1)
+void Accumulate(const Rows& t, int offset, int x0, int x1, const float* weight, float* __restrict sum_r,
+                float* __restrict sum_g, float* __restrict sum_b, float* __restrict sum_w) {
+  for (int x = x0; x < x1; ++x) {
+    const int q = x + offset;
+    sum_r[x] += weight[x] * t.r[q];
+    sum_g[x] += weight[x] * t.g[q];
+    sum_b[x] += weight[x] * t.b[q];
+    sum_w[x] += weight[x];
+  }
+}
+
+}  // namespace
+
+void AtrousDenoiser::Denoise(const std::vector<Vector3f>& color, const GuideBuffers& guides,
+                             std::vector<Vector3f>& out) const {
+  const int width = guides.width;
+  const int height = guides.height;
+  const size_t size = (size_t)width * height;
+
+  // Split into planes, demodulating the color
+  Planes current(3, size), next(3, size), normal(3, size), albedo(3, size);
+  std::vector<float> depth(size);
+  for (size_t p = 0; p < size; ++p) {
+    const float c[3] = {color[p].x, color[p].y, color[p].z};
+    const float a[3] = {guides.albedo[p].x, guides.albedo[p].y, guides.albedo[p].z};
+    const float n[3] = {guides.normal[p].x, guides.normal[p].y, guides.normal[p].z};
+    for (int k = 0; k < 3; ++k) {
+      current[k][p] = a[k] > kMinAlbedo ? c[k] / a[k] : c[k];
+      albedo[k][p] = a[k];
+      normal[k][p] = n[k];
+    }
+    // a finite stand-in for the background keeps the depth weights free of inf - inf
+    depth[p] = std::isfinite(guides.depth[p]) ? guides.depth[p] : 1e30f;
+  }
+
+  for (int iteration = 0; iteration < iterations; ++iteration) {
+    const int step = 1 << iteration;
+    const float sigma_c = sigma_color / (1 << iteration);
+    const EdgeStops inv = {1.f / (sigma_c * sigma_c), 1.f / (sigma_normal * sigma_normal),
+                           1.f / (sigma_depth * sigma_depth), 1.f / (sigma_albedo * sigma_albedo)};
+
+    ParallelFor(
+        height,
+        [&](int y) {
+          std::vector<float> sum_r(width, 0.f), sum_g(width, 0.f), sum_b(width, 0.f), sum_w(width, 0.f);
+          std::vector<float> weight(width);
+          const size_t row = (size_t)y * width;
+          const Rows center(current, normal, albedo, depth, row);
+
+          for (int dy = -2; dy <= 2; ++dy) {
+            const int ty = y + dy * step;
+            if (ty < 0 || ty >= height)
+              continue;
+            // taps of pixel x are at x + offset in this row
+            const Rows tap(current, normal, albedo, depth, (size_t)ty * width);
+            for (int dx = -2; dx <= 2; ++dx) {
+              const float h = kKernel[dy + 2] * kKernel[dx + 2];
+              const int offset = dx * step;
+              // the pixels of the row whose tap falls inside the image
+              const int x0 = std::max(0, -offset);
+              const int x1 = std::min(width, width - offset);
+
+              // Exponents, weights and sums in separate passes: only the middle one calls std::exp, the other two
+              // vectorize
+              EdgeExponents(center, tap, offset, x0, x1, inv, weight.data());
+              for (int x = x0; x < x1; ++x) {
+                weight[x] = h * std::exp(-weight[x]);
+              }
+              Accumulate(tap, offset, x0, x1, weight.data(), sum_r.data(), sum_g.data(), sum_b.data(), sum_w.data());
+            }
+          }
+
+          // the center tap always counts, so sum_w > 0
+          for (int x = 0; x < width; ++x) {
+            next[0][row + x] = sum_r[x] / sum_w[x];
+            next[1][row + x] = sum_g[x] / sum_w[x];
+            next[2][row + x] = sum_b[x] / sum_w[x];
+          }
+        },
+        num_threads);
+    std::swap(current, next);
+  }
+
+  // Modulate the albedo back in
+  out.resize(size);
+  for (size_t p = 0; p < size; ++p) {
+    float c[3];
+    for (int k = 0; k < 3; ++k) {
+      c[k] = albedo[k][p] > kMinAlbedo ? current[k][p] * albedo[k][p] : current[k][p];
+    }
+    out[p] = Vector3f(c[0], c[1], c[2]);
+  }
+}
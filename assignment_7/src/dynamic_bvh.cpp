@@ -0,0 +1,306 @@
+#include "dynamic_bvh.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "global.h"
+
+namespace {
+
+// Cost of one node traversal step relative to one primitive intersection, as for BVHAccel::SahCost()
+constexpr double kTraversalCost = 0.125;
+// Traversal stack entries kept on the machine stack; deeper trees fall back to the heap
+constexpr int kStackSize = 64;
+
+// Slab test of the box against the ray segment [0, t_max] as Bounds3::IntersectP(), also returning the distance at
+// which the ray enters the box
+inline bool IntersectBox(const Bounds3& b, const Ray& ray, const Vector3f& inv_dir, const int dir_is_neg[3],
+                         float t_max, float* t_near) {
+  float t_min = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    // written so that a NaN slab (0 * inf when the origin lies on a slab plane) is ignored
+    float t_axis_min = (b[dir_is_neg[axis]][axis] - ray.origin[axis]) * inv_dir[axis];
+    float t_axis_max = (b[1 - dir_is_neg[axis]][axis] - ray.origin[axis]) * inv_dir[axis];
+    if (t_axis_min > t_min)
+      t_min = t_axis_min;
+    if (t_axis_max < t_max)
+      t_max = t_axis_max;
+  }
+  *t_near = t_min;
+  return t_min <= t_max;
+}
+
+// Entry of the traversal stack: a node whose box the ray enters at t_near
+struct StackEntry {
+  int node;
+  float t_near;
+};
+
+}  // namespace
+
+// ----------------------------------------------------------------------------: edits
+
+int DynamicBvh::Insert(Object* object) {
+  int leaf = AllocateNode();
+  nodes_[leaf].object = object;
+  nodes_[leaf].bounds = object->GetBounds();
+  InsertLeaf(leaf);
+  ++n_objects_;
+  return leaf;
+}
+
+void DynamicBvh::Remove(int proxy) {
+  assert(nodes_[proxy].IsLeaf());
+  RemoveLeaf(proxy);
+  FreeNode(proxy);
+  --n_objects_;
+}
+
+void DynamicBvh::Move(int proxy) {
+  assert(nodes_[proxy].IsLeaf());
+  RemoveLeaf(proxy);
+  nodes_[proxy].bounds = nodes_[proxy].object->GetBounds();
+  InsertLeaf(proxy);
+}
+
+int DynamicBvh::AllocateNode() {
+  if (free_list_ == kNullNode) {
+    nodes_.emplace_back();
+    return nodes_.size() - 1;
+  }
+  int index = free_list_;
+  free_list_ = nodes_[index].parent;
+  nodes_[index] = Node();
+  return index;
+}
+
+void DynamicBvh::FreeNode(int index) {
+  nodes_[index] = Node();
+  nodes_[index].parent = free_list_;
+  nodes_[index].height = -1;  // marks it free for SahCost()
+  free_list_ = index;
+}
+
+void DynamicBvh::InsertLeaf(int leaf) {
+  if (root_ == kNullNode) {
+    root_ = leaf;
+    nodes_[leaf].parent = kNullNode;
+    return;
+  }
+
+  // Branch and bound search for the sibling that adds the least surface area to the tree: pairing with a node costs
+  // the area of the new parent plus how much every ancestor grows (the inherited cost). Below a node the cost is at
+  // least the leaf's own area plus what the node and its ancestors grow, so subtrees are skipped once that bound
+  // exceeds the best cost found; candidates are opened cheapest bound first.
+  const Bounds3 bounds = nodes_[leaf].bounds;
+  const double leaf_area = bounds.SurfaceArea();
+  int sibling = root_;
+  double best_cost = Union(nodes_[root_].bounds, bounds).SurfaceArea();
+  candidates_.clear();
+  candidates_.push_back({root_, 0.0});
+  auto cheaper_first = [](const Candidate& a, const Candidate& b) { return a.inherited_cost > b.inherited_cost; };
+  while (!candidates_.empty()) {
+    std::pop_heap(candidates_.begin(), candidates_.end(), cheaper_first);
+    Candidate candidate = candidates_.back();
+    candidates_.pop_back();
+    if (leaf_area + candidate.inherited_cost >= best_cost)
+      break;  // no candidate left can do better
+
+    const Node& node = nodes_[candidate.node];
+    double combined_area = Union(node.bounds, bounds).SurfaceArea();
+    double cost = combined_area + candidate.inherited_cost;
+    if (cost < best_cost) {
+      best_cost = cost;
+      sibling = candidate.node;
+    }
+    double inherited_cost = candidate.inherited_cost + combined_area - node.bounds.SurfaceArea();
+    if (!node.IsLeaf() && leaf_area + inherited_cost < best_cost) {
+      for (int child : node.child) {
+        candidates_.push_back({child, inherited_cost});
+        std::push_heap(candidates_.begin(), candidates_.end(), cheaper_first);
+      }
+    }
+  }
+
+  // A new parent takes the sibling's place; nodes_ may grow here, so no references are held across it
+  int old_parent = nodes_[sibling].parent;
+  int parent = AllocateNode();
+  nodes_[parent].parent = old_parent;
+  nodes_[parent].child[0] = sibling;
+  nodes_[parent].child[1] = leaf;
+  nodes_[sibling].parent = parent;
+  nodes_[leaf].parent = parent;
+  if (old_parent == kNullNode) {
+    root_ = parent;
+  } else {
+    Node& grandparent = nodes_[old_parent];
+    grandparent.child[grandparent.child[0] == sibling ? 0 : 1] = parent;
+  }
+  Refit(parent);
+}
+
+void DynamicBvh::RemoveLeaf(int leaf) {
+  if (leaf == root_) {
+    root_ = kNullNode;
+    return;
+  }
+
+  // The sibling takes the parent's place
+  int parent = nodes_[leaf].parent;
+  int grandparent = nodes_[parent].parent;
+  int sibling = nodes_[parent].child[nodes_[parent].child[0] == leaf ? 1 : 0];
+  nodes_[sibling].parent = grandparent;
+  FreeNode(parent);
+  nodes_[leaf].parent = kNullNode;
+  if (grandparent == kNullNode) {
+    root_ = sibling;
+  } else {
+    Node& node = nodes_[grandparent];
+    node.child[node.child[0] == parent ? 0 : 1] = sibling;
+    Refit(grandparent);
+  }
+}
+
+void DynamicBvh::Refit(int index) {
+  while (index != kNullNode) {
+    Update(index);
+    Rotate(index);
+    index = nodes_[index].parent;
+  }
+}
+
+void DynamicBvh::Update(int index) {
+  Node& node = nodes_[index];
+  const Node& a = nodes_[node.child[0]];
+  const Node& b = nodes_[node.child[1]];
+  node.bounds = Union(a.bounds, b.bounds);
+  node.height = 1 + std::max(a.height, b.height);
+}
+
+void DynamicBvh::Rotate(int index) {
+  // Swapping child k with a grandchild below the other child o changes nothing above index; only o's box changes,
+  // to the union of child k and the grandchild that stays. Take the swap that shrinks o's box most.
+  double best_gain = 0;
+  int best_child = -1, best_grandchild = -1;
+  for (int k = 0; k < 2; ++k) {
+    const Node& other = nodes_[nodes_[index].child[1 - k]];
+    if (other.IsLeaf())
+      continue;
+    const Bounds3& moved_up = nodes_[nodes_[index].child[k]].bounds;
+    for (int g = 0; g < 2; ++g) {
+      double gain = other.bounds.SurfaceArea() - Union(moved_up, nodes_[other.child[1 - g]].bounds).SurfaceArea();
+      if (gain > best_gain) {
+        best_gain = gain;
+        best_child = k;
+        best_grandchild = g;
+      }
+    }
+  }
+  if (best_child < 0)
+    return;
+
+  int child = nodes_[index].child[best_child];
+  int other = nodes_[index].child[1 - best_child];
+  int grandchild = nodes_[other].child[best_grandchild];
+  nodes_[index].child[best_child] = grandchild;
+  nodes_[grandchild].parent = index;
+  nodes_[other].child[best_grandchild] = child;
+  nodes_[child].parent = other;
+  Update(other);
+  Update(index);
+}
+
+// ----------------------------------------------------------------------------: queries
+
+template <bool kAnyHit, typename LeafFn>
+bool DynamicBvh::Traverse(const Ray& ray, LeafFn&& leaf) const {
+  if (root_ == kNullNode)
+    return false;
+
+  bool found = false;
+  const Vector3f& inv_dir = ray.direction_inv;
+  int dir_is_neg[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+  float t_max = std::min(ray.t_max, (double)kInfinity);
+
+  // Both child boxes are tested at their parent: the ray descends into the nearer one it enters and the farther one
+  // waits on the stack, so at most one entry per level is pending
+  StackEntry local_stack[kStackSize];
+  std::vector<StackEntry> heap_stack;
+  StackEntry* to_visit = local_stack;
+  if (Height() >= kStackSize) {
+    heap_stack.resize(Height());
+    to_visit = heap_stack.data();
+  }
+  int to_visit_offset = 0;
+  float t_near;
+  int current = IntersectBox(nodes_[root_].bounds, ray, inv_dir, dir_is_neg, t_max, &t_near) ? root_ : kNullNode;
+  while (true) {
+    if (current != kNullNode) {
+      const Node& node = nodes_[current];
+      if (node.IsLeaf()) {
+        if (leaf(node.object, t_max)) {
+          found = true;
+          if (kAnyHit)
+            return true;
+        }
+      } else {
+        float t[2];
+        bool hit[2];
+        for (int k = 0; k < 2; ++k) {
+          hit[k] = IntersectBox(nodes_[node.child[k]].bounds, ray, inv_dir, dir_is_neg, t_max, &t[k]);
+        }
+        if (hit[0] && hit[1]) {
+          int near = t[1] < t[0] ? 1 : 0;
+          to_visit[to_visit_offset++] = {node.child[1 - near], t[1 - near]};
+          current = node.child[near];
+          continue;
+        }
+        if (hit[0] || hit[1]) {
+          current = node.child[hit[0] ? 0 : 1];
+          continue;
+        }
+      }
+    }
+    // pop the next entry the ray still reaches before the closest hit
+    current = kNullNode;
+    while (to_visit_offset > 0 && current == kNullNode) {
+      const StackEntry& entry = to_visit[--to_visit_offset];
+      if (entry.t_near <= t_max)
+        current = entry.node;
+    }
+    if (current == kNullNode)
+      break;
+  }
+  return found;
+}
+
+Intersection DynamicBvh::Intersect(const Ray& ray) const {
+  Intersection hit;
+  // The ray is narrowed to the closest hit so far, so nested BVHs of the objects cull against it too
+  Ray clipped = ray;
+  Traverse<false>(ray, [&](Object* object, float& t_max) {
+    Intersection object_hit = object->GetIntersection(clipped);
+    if (!object_hit.happened || object_hit.distance >= t_max)
+      return false;
+    hit = object_hit;
+    t_max = hit.distance;
+    clipped.t_max = hit.distance;
+    return true;
+  });
+  return hit;
+}
+
+bool DynamicBvh::IntersectP(const Ray& ray) const {
+  return Traverse<true>(ray, [&](Object* object, float&) { return object->Intersect(ray); });
+}
+
+double DynamicBvh::SahCost() const {
+  if (root_ == kNullNode)
+    return 0;
+  double cost = 0;
+  for (const Node& node : nodes_) {
+    if (node.height >= 0)
+      cost += node.bounds.SurfaceArea() * (node.IsLeaf() ? 1 : kTraversalCost);
+  }
+  return cost / nodes_[root_].bounds.SurfaceArea();
+}
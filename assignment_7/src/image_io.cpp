@@ -0,0 +1,302 @@
+#include "image_io.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "global.h"
+
+// All binary output is written in host byte order, which the formats below expect to be little endian.
+
+namespace {
+
+// Output goes through a stdio buffer this large, so the many small writes of a header cost no system calls
+constexpr size_t kFileBufferSize = 1 << 20;
+
+template <typename T>
+void Append(std::vector<char>& buffer, const T& value) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+void AppendString(std::vector<char>& buffer, const char* s) {
+  buffer.insert(buffer.end(), s, s + std::strlen(s) + 1);
+}
+
+bool HasExtension(const std::string& path, const char* extension) {
+  size_t n = std::strlen(extension);
+  if (path.size() < n)
+    return false;
+  return std::equal(path.end() - n, path.end(), extension,
+                    [](char a, char b) { return std::tolower((unsigned char)a) == b; });
+}
+
+// ----------------------------------------------------------------------------: ppm
+
+class PpmWriter : public ImageWriter {
+public:
+  PpmWriter(FILE* fp, int width, int height, int channels) : ImageWriter(fp, width, height, channels) {
+    char header[64];
+    int n = std::snprintf(header, sizeof(header), "%s\n%d %d\n255\n", channels == 1 ? "P5" : "P6", width, height);
+    Write(header, n);
+  }
+
+  bool WriteRows(const float* pixels, int count) override {
+    size_t values = (size_t)count * width_ * channels_;
+    buffer_.resize(values);
+    for (size_t i = 0; i < values; ++i) {
+      buffer_[i] = (char)(unsigned char)(255 * std::pow(Clamp(0, 1, pixels[i]), 0.6f));
+    }
+    next_row_ += count;
+    return Write(buffer_.data(), values);
+  }
+};
+
+// ----------------------------------------------------------------------------: pfm
+
+// PFM stores the bottom row first, so every band is written backwards to where it belongs
+class PfmWriter : public ImageWriter {
+public:
+  PfmWriter(FILE* fp, int width, int height, int channels) : ImageWriter(fp, width, height, channels) {
+    char header[64];
+    header_size_ = std::snprintf(header, sizeof(header), "%s\n%d %d\n-1.0\n", channels == 1 ? "Pf" : "PF", width,
+                                 height);
+    Write(header, header_size_);
+  }
+
+  bool WriteRows(const float* pixels, int count) override {
+    size_t row_bytes = (size_t)width_ * channels_ * sizeof(float);
+    buffer_.resize(count * row_bytes);
+    for (int r = 0; r < count; ++r) {
+      std::memcpy(buffer_.data() + (count - 1 - r) * row_bytes, pixels + (size_t)r * width_ * channels_, row_bytes);
+    }
+    // the band ends, in file order, with the first row given
+    int last_row = next_row_ + count - 1;
+    next_row_ += count;
+    return Seek(header_size_ + (long)(height_ - 1 - last_row) * row_bytes) && Write(buffer_.data(), buffer_.size());
+  }
+
+private:
+  int header_size_;
+};
+
+// ----------------------------------------------------------------------------: exr
+
+// Scanline OpenEXR, one line per block:
+//   magic, version, header attributes, offset table of one uint64 per line, then per line
+//   int32 y, int32 byte count, the line of every channel in turn, channels in alphabetical order
+class ExrWriter : public ImageWriter {
+public:
+  ExrWriter(FILE* fp, int width, int height, int channels, ExrCompression compression)
+      : ImageWriter(fp, width, height, channels), compression_(compression), offsets_(height) {
+    // alphabetical channel order, with the index of each in the interleaved input
+    if (channels == 1)
+      channels_sorted_ = {{"Y", 0}};
+    else
+      channels_sorted_ = {{"B", 2}, {"G", 1}, {"R", 0}};
+
+    std::vector<char> header;
+    Append<uint32_t>(header, 20000630);  // magic number
+    Append<uint32_t>(header, 2);         // version 2, single part scanline
+    // chlist: name, pixel type (2: float), pLinear, 3 reserved bytes, x and y sampling
+    std::vector<char> chlist;
+    for (const auto& channel : channels_sorted_) {
+      AppendString(chlist, channel.first);
+      Append<int32_t>(chlist, 2);
+      Append<uint32_t>(chlist, 0);
+      Append<int32_t>(chlist, 1);
+      Append<int32_t>(chlist, 1);
+    }
+    chlist.push_back(0);
+    AppendAttribute(header, "channels", "chlist", chlist);
+    AppendAttribute(header, "compression", "compression",
+                    {(char)(compression == ExrCompression::kRle ? 1 : 0)});
+    std::vector<char> window;
+    for (int32_t v : {0, 0, width - 1, height - 1}) {
+      Append(window, v);
+    }
+    AppendAttribute(header, "dataWindow", "box2i", window);
+    AppendAttribute(header, "displayWindow", "box2i", window);
+    AppendAttribute(header, "lineOrder", "lineOrder", {0});  // increasing y
+    std::vector<char> one;
+    Append(one, 1.f);
+    AppendAttribute(header, "pixelAspectRatio", "float", one);
+    std::vector<char> center;
+    Append(center, 0.f);
+    Append(center, 0.f);
+    AppendAttribute(header, "screenWindowCenter", "v2f", center);
+    AppendAttribute(header, "screenWindowWidth", "float", one);
+    header.push_back(0);  // end of header
+
+    table_position_ = header.size();
+    // the offset table is filled in by Finish(), lines are written after it as they come
+    header.resize(header.size() + height * sizeof(uint64_t), 0);
+    position_ = header.size();
+    Write(header.data(), header.size());
+  }
+
+  ~ExrWriter() override { Close(); }  // the base destructor would no longer reach Finish()
+
+  bool WriteRows(const float* pixels, int count) override {
+    size_t line_bytes = (size_t)width_ * channels_ * sizeof(float);
+    buffer_.clear();
+    for (int r = 0; r < count; ++r) {
+      const float* row = pixels + (size_t)r * width_ * channels_;
+      // planar line
+      line_.resize(line_bytes);
+      float* out = reinterpret_cast<float*>(line_.data());
+      for (const auto& channel : channels_sorted_) {
+        for (int x = 0; x < width_; ++x) {
+          *out++ = row[x * channels_ + channel.second];
+        }
+      }
+      const std::vector<char>* data = &line_;
+      if (compression_ == ExrCompression::kRle) {
+        CompressRle(line_, packed_);
+        // readers take a block as stored raw unless it is smaller than the raw line
+        if (packed_.size() < line_.size())
+          data = &packed_;
+      }
+
+      offsets_[next_row_] = position_;
+      Append<int32_t>(buffer_, next_row_);
+      Append<int32_t>(buffer_, data->size());
+      buffer_.insert(buffer_.end(), data->begin(), data->end());
+      position_ += 8 + data->size();
+      ++next_row_;
+    }
+    return Write(buffer_.data(), buffer_.size());
+  }
+
+protected:
+  bool Finish() override {
+    return next_row_ == height_ && Seek(table_position_) && Write(offsets_.data(), offsets_.size() * sizeof(uint64_t));
+  }
+
+private:
+  static void AppendAttribute(std::vector<char>& header, const char* name, const char* type,
+                              const std::vector<char>& value) {
+    AppendString(header, name);
+    AppendString(header, type);
+    Append<int32_t>(header, value.size());
+    header.insert(header.end(), value.begin(), value.end());
+  }
+
+  // OpenEXR's RLE: the bytes are split into the even and the odd ones, delta encoded, then run-length encoded with
+  // runs of 3 to 128 equal bytes as (count - 1, byte) and literal stretches as (-count, bytes...)
+  void CompressRle(const std::vector<char>& in, std::vector<char>& out) {
+    size_t n = in.size();
+    deltas_.resize(n);
+    size_t half = (n + 1) / 2;
+    for (size_t i = 0; i < n; ++i) {
+      deltas_[i % 2 == 0 ? i / 2 : half + i / 2] = in[i];
+    }
+    unsigned char previous = deltas_[0];
+    for (size_t i = 1; i < n; ++i) {
+      unsigned char current = deltas_[i];
+      deltas_[i] = (char)(unsigned char)(current - previous + 128);
+      previous = current;
+    }
+
+    constexpr size_t kMinRun = 3, kMaxRun = 127;
+    out.clear();
+    const char* data = deltas_.data();
+    size_t start = 0, end = 1;
+    while (start < n) {
+      while (end < n && data[start] == data[end] && end - start - 1 < kMaxRun) {
+        ++end;
+      }
+      if (end - start >= kMinRun) {
+        out.push_back((char)(end - start - 1));
+        out.push_back(data[start]);
+        start = end;
+      } else {
+        // a literal stretch ends where a run of three begins
+        while (end < n &&
+               (end + 1 >= n || data[end] != data[end + 1] || end + 2 >= n || data[end + 1] != data[end + 2]) &&
+               end - start < kMaxRun) {
+          ++end;
+        }
+        out.push_back((char)-(int)(end - start));
+        out.insert(out.end(), data + start, data + end);
+        start = end;
+      }
+      ++end;
+    }
+  }
+
+private:
+  const ExrCompression compression_;
+  std::vector<std::pair<const char*, int>> channels_sorted_;
+  std::vector<uint64_t> offsets_;
+  long table_position_;
+  uint64_t position_;
+  std::vector<char> line_, packed_, deltas_;
+};
+
+}  // namespace
+
+// ----------------------------------------------------------------------------: writer
+
+ImageWriter::ImageWriter(FILE* fp, int width, int height, int channels)
+    : fp_(fp), width_(width), height_(height), channels_(channels) {
+  std::setvbuf(fp_, nullptr, _IOFBF, kFileBufferSize);
+}
+
+ImageWriter::~ImageWriter() {
+  Close();
+}
+
+bool ImageWriter::Close() {
+  if (fp_ == nullptr)
+    return ok_;
+  ok_ = Finish() && ok_;
+  ok_ = std::fclose(fp_) == 0 && ok_;
+  fp_ = nullptr;
+  return ok_;
+}
+
+bool ImageWriter::Write(const void* data, size_t bytes) {
+  ok_ = ok_ && std::fwrite(data, 1, bytes, fp_) == bytes;
+  return ok_;
+}
+
+bool ImageWriter::Seek(long offset) {
+  ok_ = ok_ && std::fseek(fp_, offset, SEEK_SET) == 0;
+  return ok_;
+}
+
+std::unique_ptr<ImageWriter> CreateImageWriter(const std::string& path, int width, int height, int channels,
+                                               ExrCompression exr_compression) {
+  enum { kPpm, kPfm, kExr } format;
+  if (HasExtension(path, ".ppm"))
+    format = kPpm;
+  else if (HasExtension(path, ".pfm"))
+    format = kPfm;
+  else if (HasExtension(path, ".exr"))
+    format = kExr;
+  else
+    return nullptr;
+  if (channels != 1 && channels != 3)
+    return nullptr;
+
+  FILE* fp = std::fopen(path.c_str(), "wb");
+  if (fp == nullptr)
+    return nullptr;
+  switch (format) {
+    case kPpm:
+      return std::make_unique<PpmWriter>(fp, width, height, channels);
+    case kPfm:
+      return std::make_unique<PfmWriter>(fp, width, height, channels);
+    default:
+      return std::make_unique<ExrWriter>(fp, width, height, channels, exr_compression);
+  }
+}
+
+bool WriteImage(const std::string& path, int width, int height, int channels, const float* pixels,
+                ExrCompression exr_compression) {
+  std::unique_ptr<ImageWriter> writer = CreateImageWriter(path, width, height, channels, exr_compression);
+  return writer != nullptr && writer->WriteRows(pixels, height) && writer->Close();
+}
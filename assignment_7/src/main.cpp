@@ -1,10 +1,25 @@
 #include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
 
 #include "objects/mesh_triangle.h"
 #include "renderer.h"
 #include "scene.h"
 #include "utils/vector.h"
 
+namespace {
+
+Renderer* g_renderer = nullptr;
+
+// Ctrl-C, or the SIGTERM of a preempting scheduler, ends a progressive render after the current pass, with the image
+// and the checkpoint so far saved
+void OnInterrupt(int) {
+  g_renderer->cancel = true;
+}
+
+}  // namespace
+
 // In the main function of the program, we create the scene (create objects and
 // lights) as well as set the options for the render (image width and height,
 // maximum recursion depth, field-of-view, etc.). We then call the render
@@ -12,24 +27,103 @@
 int main(int argc, char** argv) {
   // Change the definition here to change resolution
   Scene scene(784, 784);
+  Renderer r;
+  bool specular_boxes = false;
+
+  // command line options: --spp N, --threads N, --tile N, --bvh binary|wide4, --split naive|sah|lbvh, --max-depth N,
+  // --sampler independent|sobol, --adaptive THRESHOLD, --max-spp N, --heatmap FILE,
+  // --first-hit N, --progressive SECONDS (0: until --spp passes), --preview FILE, --checkpoint FILE,
+  // --checkpoint-every SECONDS, --denoise on|off, --output FILE.ppm|pfm|exr, --aov albedo,normal,depth,samples,
+  // --exr-compression none|rle, --stream on|off, --width N, --height N, --boxes diffuse|specular
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--spp") == 0)
+      r.spp = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--threads") == 0)
+      r.num_threads = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--tile") == 0)
+      r.tile_size = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--bvh") == 0)
+      scene.bvh_layout = std::strcmp(argv[i + 1], "binary") == 0 ? BVHAccel::NodeLayout::kBinary
+                                                                   : BVHAccel::NodeLayout::kWide4;
+    else if (std::strcmp(argv[i], "--sampler") == 0)
+      r.sampler_type = std::strcmp(argv[i + 1], "independent") == 0 ? SamplerType::kIndependent : SamplerType::kSobol;
+    else if (std::strcmp(argv[i], "--adaptive") == 0) {
+      r.adaptive = true;
+      r.adaptive_threshold = std::atof(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--max-spp") == 0)
+      r.adaptive_max_spp = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--progressive") == 0) {
+      r.progressive = true;
+      r.time_budget = std::atof(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--preview") == 0) {
+      std::string preview = argv[i + 1];
+      r.on_pass = [&r, &scene, preview](const std::vector<Vector3f>& framebuffer, int) {
+        r.SaveImage(preview, scene, framebuffer);
+      };
+    } else if (std::strcmp(argv[i], "--checkpoint") == 0) {
+      r.progressive = true;  // checkpoints are taken between progressive passes
+      r.checkpoint_file = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--checkpoint-every") == 0)
+      r.checkpoint_interval = std::atof(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--stream") == 0)
+      r.stream_output = std::strcmp(argv[i + 1], "on") == 0;
+    else if (std::strcmp(argv[i], "--width") == 0)
+      scene.width = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--height") == 0)
+      scene.height = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--output") == 0)
+      r.output_file = argv[i + 1];
+    else if (std::strcmp(argv[i], "--aov") == 0) {
+      for (Aov aov : {Aov::kAlbedo, Aov::kNormal, Aov::kDepth, Aov::kSampleCount}) {
+        if (std::strstr(argv[i + 1], AovName(aov)) != nullptr)
+          r.aovs.push_back(aov);
+      }
+    } else if (std::strcmp(argv[i], "--exr-compression") == 0)
+      r.exr_compression = std::strcmp(argv[i + 1], "none") == 0 ? ExrCompression::kNone : ExrCompression::kRle;
+    else if (std::strcmp(argv[i], "--denoise") == 0)
+      r.denoise = std::strcmp(argv[i + 1], "on") == 0;
+    else if (std::strcmp(argv[i], "--first-hit") == 0)
+      r.first_hit_samples = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--heatmap") == 0)
+      r.heat_map_file = argv[i + 1];
+    else if (std::strcmp(argv[i], "--boxes") == 0)
+      specular_boxes = std::strcmp(argv[i + 1], "specular") == 0;
+    else if (std::strcmp(argv[i], "--max-depth") == 0)
+      scene.max_depth = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--split") == 0)
+      scene.bvh_split = std::strcmp(argv[i + 1], "naive") == 0  ? BVHAccel::SplitMethod::kNaive
+                        : std::strcmp(argv[i + 1], "lbvh") == 0 ? BVHAccel::SplitMethod::kLBVH
+                                                                : BVHAccel::SplitMethod::kSAH;
+    else
+      std::cerr << "Unknown option: " << argv[i] << "\n";
+  }
 
-  Material* red = new Material(kDiffuse, Vector3f(0.0f));
-  red->kd = Vector3f(0.63f, 0.065f, 0.05f);
-  Material* green = new Material(kDiffuse, Vector3f(0.0f));
-  green->kd = Vector3f(0.14f, 0.45f, 0.091f);
-  Material* white = new Material(kDiffuse, Vector3f(0.0f));
-  white->kd = Vector3f(0.725f, 0.71f, 0.68f);
-  Material* light = new Material(kDiffuse, (8.0f * Vector3f(0.747f + 0.058f, 0.747f + 0.258f, 0.747f) +
-                                            15.6f * Vector3f(0.740f + 0.287f, 0.740f + 0.160f, 0.740f) +
-                                            18.4f * Vector3f(0.737f + 0.642f, 0.737f + 0.159f, 0.737f)));
-  light->kd = Vector3f(0.65f);
-
-  MeshTriangle floor("../models/cornellbox/floor.obj", white);
-  MeshTriangle shortbox("../models/cornellbox/shortbox.obj", white);
-  MeshTriangle tallbox("../models/cornellbox/tallbox.obj", white);
-  MeshTriangle left("../models/cornellbox/left.obj", red);
-  MeshTriangle right("../models/cornellbox/right.obj", green);
-  MeshTriangle light_("../models/cornellbox/light.obj", light);
+  Material red(kDiffuse, Vector3f(0.0f));
+  red.kd = Vector3f(0.63f, 0.065f, 0.05f);
+  Material green(kDiffuse, Vector3f(0.0f));
+  green.kd = Vector3f(0.14f, 0.45f, 0.091f);
+  Material white(kDiffuse, Vector3f(0.0f));
+  white.kd = Vector3f(0.725f, 0.71f, 0.68f);
+  Material light(kDiffuse, (8.0f * Vector3f(0.747f + 0.058f, 0.747f + 0.258f, 0.747f) +
+                            15.6f * Vector3f(0.740f + 0.287f, 0.740f + 0.160f, 0.740f) +
+                            18.4f * Vector3f(0.737f + 0.642f, 0.737f + 0.159f, 0.737f)));
+  light.kd = Vector3f(0.65f);
+  // --boxes specular: a glass short box and a brushed gold tall box
+  Material glass(kDielectric, Vector3f(0.0f));
+  glass.ior = 1.5f;
+  glass.specular_exponent = 2000.f;
+  Material gold(kConductor, Vector3f(0.0f));
+  gold.ks = Vector3f(1.0f, 0.78f, 0.34f);
+  gold.specular_exponent = 200.f;
+
+  MeshTriangle floor("../models/cornellbox/floor.obj", &white, scene.bvh_layout, scene.bvh_split);
+  MeshTriangle shortbox("../models/cornellbox/shortbox.obj", specular_boxes ? &glass : &white, scene.bvh_layout,
+                        scene.bvh_split);
+  MeshTriangle tallbox("../models/cornellbox/tallbox.obj", specular_boxes ? &gold : &white, scene.bvh_layout,
+                       scene.bvh_split);
+  MeshTriangle left("../models/cornellbox/left.obj", &red, scene.bvh_layout, scene.bvh_split);
+  MeshTriangle right("../models/cornellbox/right.obj", &green, scene.bvh_layout, scene.bvh_split);
+  MeshTriangle light_("../models/cornellbox/light.obj", &light, scene.bvh_layout, scene.bvh_split);
 
   scene.Add(&floor);
   scene.Add(&shortbox);
@@ -40,7 +134,11 @@ int main(int argc, char** argv) {
 
   scene.BuildBVH();
 
-  Renderer r;
+  if (r.progressive) {
+    g_renderer = &r;
+    std::signal(SIGINT, OnInterrupt);
+    std::signal(SIGTERM, OnInterrupt);
+  }
 
   auto start = std::chrono::system_clock::now();
   r.Render(scene);
@@ -1,6 +1,84 @@
 #include "material.h"
 #include "global.h"
 
+namespace {
+
+// Smallest GGX alpha; smoother surfaces would need delta lobes
+constexpr float kMinRoughness = 1e-3f;
+
+// GGX distribution of microfacet normals h, cos_h = N . h
+inline float GgxD(float cos_h, float alpha) {
+  if (cos_h <= 0)
+    return 0;
+  float a2 = alpha * alpha;
+  float d = cos_h * cos_h * (a2 - 1) + 1;
+  return a2 / (kPi * d * d);
+}
+
+// Smith masking of one direction, cos_v = |N . v|
+inline float GgxG1(float cos_v, float alpha) {
+  float a2 = alpha * alpha;
+  return 2 * cos_v / (cos_v + std::sqrt(a2 + (1 - a2) * cos_v * cos_v));
+}
+
+// Microfacet normal in the local frame (z = N), distributed as D(h) (N . h)
+inline Vector3f SampleGgxNormal(const Vector2f& u, float alpha) {
+  float cos_theta = std::sqrt((1 - u.x) / (1 + (alpha * alpha - 1) * u.x));
+  float sin_theta = std::sqrt(std::max(0.f, 1 - cos_theta * cos_theta));
+  float phi = 2 * kPi * u.y;
+  return Vector3f(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+inline Vector3f SchlickFresnel(const Vector3f& f0, float cos_theta) {
+  float m = Clamp(0, 1, 1 - cos_theta);
+  return f0 + (Vector3f(1.f) - f0) * (m * m * m * m * m);
+}
+
+// Geometry of a dielectric scattering event: wi arrives, wo leaves, N is the geometric normal
+struct DielectricEvent {
+  bool valid = false;
+  bool reflect;
+  Vector3f n;             // N flipped to the side wi comes from
+  Vector3f h;             // microfacet normal, on the side of n
+  Vector3f fresnel_n;     // h oriented like N, as Material::Fresnel expects
+  float eta_i, eta_t;     // indices on the incoming and the other side
+  float cos_i, cos_o;     // |n . wi|, |n . wo|
+  float i_h, o_h;         // -wi . h > 0 and wo . h
+};
+
+inline DielectricEvent MakeDielectricEvent(const Vector3f& wi, const Vector3f& wo, const Vector3f& N, float ior) {
+  DielectricEvent e;
+  float cos_i = -DotProduct(wi, N), cos_o = DotProduct(wo, N);
+  if (cos_i == 0 || cos_o == 0)
+    return e;
+  bool entering = cos_i > 0;
+  e.reflect = cos_i * cos_o > 0;
+  e.n = entering ? N : -N;
+  e.eta_i = entering ? 1 : ior;
+  e.eta_t = entering ? ior : 1;
+  e.cos_i = std::fabs(cos_i);
+  e.cos_o = std::fabs(cos_o);
+  // half vector of the reflection, or of the refraction (Walter et al. 2007)
+  Vector3f h = e.reflect ? -wi + wo : -wi * e.eta_i + wo * e.eta_t;
+  if (DotProduct(h, h) == 0)
+    return e;
+  e.h = Normalize(h);
+  if (DotProduct(e.h, e.n) < 0)
+    e.h = -e.h;
+  e.fresnel_n = entering ? e.h : -e.h;
+  e.i_h = -DotProduct(wi, e.h);
+  e.o_h = DotProduct(wo, e.h);
+  // the microfacet must face the incoming ray, and a refracted ray must cross it
+  e.valid = e.i_h > 0 && (e.reflect ? e.o_h > 0 : e.o_h < 0);
+  return e;
+}
+
+}  // namespace
+
+float Material::Roughness() const {
+  return std::max(kMinRoughness, std::sqrt(2 / (specular_exponent + 2)));
+}
+
 Material::Material(MaterialType t, Vector3f e) {
   type = t;
   emission = e;
@@ -79,17 +157,35 @@ Vector3f Material::GetColorAt(double u, double v) {
   return Vector3f();
 }
 
-Vector3f Material::Sample(const Vector3f& wi, const Vector3f& N) {
+Vector3f Material::Sample(const Vector3f& wi, const Vector3f& N, Sampler& sampler) {
   switch (type) {
     case kDiffuse: {
-      // uniform sample on the hemisphere
-      float x_1 = GetRandomFloat(), x_2 = GetRandomFloat();
-      float z = std::fabs(1.0f - 2.0f * x_1);
-      float r = std::sqrt(1.0f - z * z), phi = 2 * kPi * x_2;
-      Vector3f local_ray(r * std::cos(phi), r * std::sin(phi), z);
+      // cosine weighted sample on the hemisphere
+      Vector2f u = sampler.Get2D();
+      float r = std::sqrt(u.x), phi = 2 * kPi * u.y;
+      Vector3f local_ray(r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.f, 1 - u.x)));
       return ToWorld(local_ray, N);
-
-      break;
+    }
+    case kConductor: {
+      // mirror about a microfacet normal drawn from D(h) (N . h)
+      Vector3f h = ToWorld(SampleGgxNormal(sampler.Get2D(), Roughness()), N);
+      return Reflect(wi, h);
+    }
+    case kDielectric: {
+      // pick a microfacet on the side of the incoming ray, then reflect or refract in proportion to Fresnel
+      bool entering = DotProduct(wi, N) < 0;
+      Vector3f h = ToWorld(SampleGgxNormal(sampler.Get2D(), Roughness()), entering ? N : -N);
+      if (DotProduct(wi, h) >= 0)
+        return Vector3f();  // a back-facing microfacet, the caller sees pdf 0
+      Vector3f fresnel_n = entering ? h : -h;
+      float kr;
+      Fresnel(wi, fresnel_n, ior, kr);
+      bool reflect = sampler.Get1D() < kr;
+      Vector3f wo = reflect ? Reflect(wi, h) : Normalize(Refract(wi, fresnel_n, ior));
+      // steep microfacets can send the ray to the wrong side of the surface
+      if ((DotProduct(wo, N) * DotProduct(wi, N) < 0) != reflect)
+        return Vector3f();
+      return wo;
     }
   }
   return Vector3f();
@@ -98,12 +194,29 @@ Vector3f Material::Sample(const Vector3f& wi, const Vector3f& N) {
 float Material::Pdf(const Vector3f& wi, const Vector3f& wo, const Vector3f& N) {
   switch (type) {
     case kDiffuse: {
-      // uniform sample probability 1 / (2 * PI)
-      if (DotProduct(wo, N) > 0.0f)
-        return 0.5f / kPi;
-      else
+      // cosine weighted sample probability cos / PI
+      float cos_theta = DotProduct(wo, N);
+      return cos_theta > 0.0f ? cos_theta / kPi : 0.0f;
+    }
+    case kConductor: {
+      float cos_i = -DotProduct(wi, N), cos_o = DotProduct(wo, N);
+      if (cos_i <= 0 || cos_o <= 0)
         return 0.0f;
-      break;
+      Vector3f h = Normalize(wo - wi);
+      // D(h) (N . h) carried over to directions: dwo = 4 (wo . h) dh
+      return GgxD(DotProduct(N, h), Roughness()) * DotProduct(N, h) / (4 * DotProduct(wo, h));
+    }
+    case kDielectric: {
+      DielectricEvent e = MakeDielectricEvent(wi, wo, N, ior);
+      if (!e.valid)
+        return 0.0f;
+      float kr;
+      Fresnel(wi, e.fresnel_n, ior, kr);
+      float pdf_h = GgxD(DotProduct(e.n, e.h), Roughness()) * DotProduct(e.n, e.h);
+      if (e.reflect)
+        return kr * pdf_h / (4 * e.i_h);
+      float denom = e.eta_i * e.i_h + e.eta_t * e.o_h;
+      return (1 - kr) * pdf_h * e.eta_t * e.eta_t * std::fabs(e.o_h) / (denom * denom);
     }
   }
   return 0.0f;
@@ -120,7 +233,31 @@ Vector3f Material::Eval(const Vector3f& wi, const Vector3f& wo, const Vector3f&
       } else {
         return Vector3f(0.0f);
       }
-      break;
+    }
+    case kConductor: {
+      // Cook-Torrance: F D G / (4 cos_i cos_o)
+      float cos_i = -DotProduct(wi, N), cos_o = DotProduct(wo, N);
+      if (cos_i <= 0 || cos_o <= 0)
+        return Vector3f(0.0f);
+      Vector3f h = Normalize(wo - wi);
+      float alpha = Roughness();
+      float dg = GgxD(DotProduct(N, h), alpha) * GgxG1(cos_i, alpha) * GgxG1(cos_o, alpha);
+      return SchlickFresnel(ks, DotProduct(wo, h)) * (dg / (4 * cos_i * cos_o));
+    }
+    case kDielectric: {
+      DielectricEvent e = MakeDielectricEvent(wi, wo, N, ior);
+      if (!e.valid)
+        return Vector3f(0.0f);
+      float kr;
+      Fresnel(wi, e.fresnel_n, ior, kr);
+      float alpha = Roughness();
+      float dg = GgxD(DotProduct(e.n, e.h), alpha) * GgxG1(e.cos_i, alpha) * GgxG1(e.cos_o, alpha);
+      if (e.reflect)
+        return ks * (kr * dg / (4 * e.cos_i * e.cos_o));
+      // Walter et al. 2007 BTDF; radiance is carried, hence eta_i^2 rather than eta_t^2 in the numerator
+      float denom = e.eta_i * e.i_h + e.eta_t * e.o_h;
+      return ks * ((1 - kr) * dg * e.i_h * std::fabs(e.o_h) * e.eta_i * e.eta_i /
+                   (denom * denom * e.cos_i * e.cos_o));
     }
   }
   return Vector3f();
@@ -0,0 +1,91 @@
+#include "objects/instance.h"
+
+Instance::Instance(MeshTriangle* mesh, const Transform& object_to_world, Material* material)
+    : mesh_(mesh), transform_(object_to_world), material_(material) {}
+
+namespace {
+
+// The ray in object space with a unit direction again, as the mesh's triangle tests expect: their parallel-ray
+// cutoff is absolute, so hits must not depend on how the transform scales the direction. Object space distances
+// are *scale times the world ones.
+Ray ToObject(const Transform& transform, const Ray& ray, float* scale) {
+  Ray local = transform.InverseRay(ray);
+  *scale = local.direction.Norm();
+  Ray unit(local.origin, local.direction / *scale, local.t);
+  unit.t_max = ray.t_max * *scale;
+  return unit;
+}
+
+}  // namespace
+
+bool Instance::Intersect(const Ray& ray) {
+  float scale;
+  return mesh_->Intersect(ToObject(transform_, ray, &scale));
+}
+
+bool Instance::Intersect(const Ray& ray, float& tnear, uint32_t& index) const {
+  // The legacy index-based query is not served, as for Triangle: the mesh does not keep the vertex arrays it would
+  // walk, so hits come from GetIntersection() through the mesh's BVH instead.
+  return false;
+}
+
+Intersection Instance::GetIntersection(Ray ray) {
+  float scale;
+  Intersection hit = mesh_->GetIntersection(ToObject(transform_, ray, &scale));
+  if (hit.happened) {
+    hit.distance /= scale;
+    hit.coords = ray(hit.distance);
+    hit.normal = transform_.Normal(hit.normal);
+    hit.obj = this;
+    if (material_)
+      hit.m = material_;
+  }
+  return hit;
+}
+
+void Instance::GetSurfaceProperties(const Vector3f& P, const Vector3f& I, const uint32_t& index, const Vector2f& uv,
+                                    Vector3f& N, Vector2f& st) const {
+  // Only meaningful after the index-based Intersect(); GetIntersection() fills in the world space normal itself
+}
+
+float Instance::GetArea() {
+  // Refits happen between frames, never while rays are traced, so only the first call after one takes the lock
+  int refit_count = mesh_->RefitCount();
+  if (area_refit_count_.load(std::memory_order_acquire) != refit_count) {
+    std::lock_guard<std::mutex> lock(area_mutex_);
+    if (area_refit_count_.load(std::memory_order_relaxed) != refit_count) {
+      ComputeArea();
+      area_refit_count_.store(refit_count, std::memory_order_release);
+    }
+  }
+  return area_;
+}
+
+void Instance::ComputeArea() {
+  const TriangleBlock& triangles = mesh_->triangles;
+  std::vector<float> areas(triangles.Size());
+  area_ = 0;
+  for (int i = 0; i < triangles.Size(); ++i) {
+    areas[i] = CrossProduct(transform_.Vector(triangles.E1(i)), transform_.Vector(triangles.E2(i))).Norm() * 0.5f;
+    area_ += areas[i];
+  }
+  triangle_table_.Build(areas);
+}
+
+void Instance::Sample(Intersection& pos, float& pdf, Sampler& sampler) {
+  GetArea();
+  const TriangleBlock& triangles = mesh_->triangles;
+  int i = triangle_table_.Sample(sampler.Get1D());
+  if (i < 0) {
+    // no triangle has any area
+    pdf = 0;
+    return;
+  }
+  Vector2f u = sampler.Get2D();
+  float x = std::sqrt(u.x), y = u.y;
+  Vector3f p = triangles.V0(i) + triangles.E1(i) * (x * (1.0f - y)) + triangles.E2(i) * (x * y);
+  pos.coords = transform_.Point(p);
+  pos.normal = transform_.Normal(triangles.Normal(i));
+  pos.emit = material_ ? material_->GetEmission() : mesh_->m->GetEmission();
+  pdf = 1.0f / area_;
+}
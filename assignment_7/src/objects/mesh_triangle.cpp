@@ -1,4 +1,5 @@
 #include "objects/mesh_triangle.h"
+#include "objects/triangle.h"
 #include "utils/obj_loader.h"
 
 Vector3f MeshTriangle::EvalDiffuseColor(const Vector2f& st) const {
@@ -7,19 +8,70 @@ Vector3f MeshTriangle::EvalDiffuseColor(const Vector2f& st) const {
   return Lerp(Vector3f(0.815, 0.235, 0.031), Vector3f(0.937, 0.937, 0.231), pattern);
 }
 
+namespace {
+
+// Hands the BVH leaves of a mesh to the SIMD triangle test and remembers the closest hit
+class MeshLeafIntersector : public LeafIntersector {
+public:
+  explicit MeshLeafIntersector(const TriangleBlock& triangles) : triangles_(triangles) {}
+
+  bool Intersect(const Ray& ray, int first, int count, float& t_max) override {
+    if (!triangles_.Intersect(ray, first, count, t_max, index, u, v))
+      return false;
+    t = t_max;
+    return true;
+  }
+
+  bool IntersectP(const Ray& ray, int first, int count, float t_max) override {
+    return triangles_.IntersectP(ray, first, count, t_max);
+  }
+
+public:
+  int index = -1;
+  float t = 0, u = 0, v = 0;
+
+private:
+  const TriangleBlock& triangles_;
+};
+
+}  // namespace
+
 Intersection MeshTriangle::GetIntersection(Ray ray) {
   Intersection intersec;
 
-  if (bvh) {
-    intersec = bvh->Intersect(ray);
+  MeshLeafIntersector leaves(triangles);
+  if (bvh && bvh->Intersect(ray, leaves)) {
+    intersec.happened = true;
+    intersec.coords = ray(leaves.t);
+    intersec.normal = triangles.Normal(leaves.index);
+    intersec.distance = leaves.t;
+    intersec.obj = this;
+    intersec.m = materials[triangles.MaterialIndex(leaves.index)];
   }
 
   return intersec;
 }
 
-void MeshTriangle::Sample(Intersection& pos, float& pdf) {
-  bvh->Sample(pos, pdf);
+bool MeshTriangle::Intersect(const Ray& ray) {
+  MeshLeafIntersector leaves(triangles);
+  return bvh && bvh->IntersectP(ray, leaves);
+}
+
+void MeshTriangle::Sample(Intersection& pos, float& pdf, Sampler& sampler) {
+  // a triangle in proportion to its area, then a uniform point on it: uniform over the whole mesh
+  int i = triangle_table.Sample(sampler.Get1D());
+  if (i < 0) {
+    // no triangle has any area
+    pdf = 0;
+    return;
+  }
+  Vector2f u = sampler.Get2D();
+  float x = std::sqrt(u.x), y = u.y;
+  Vector3f v0 = triangles.V0(i);
+  pos.coords = v0 + triangles.E1(i) * (x * (1.0f - y)) + triangles.E2(i) * (x * y);
+  pos.normal = triangles.Normal(i);
   pos.emit = m->GetEmission();
+  pdf = 1.0f / area;
 }
 
 void MeshTriangle::GetSurfaceProperties(const Vector3f& P, const Vector3f& I, const uint32_t& index, const Vector2f& uv,
@@ -53,11 +105,13 @@ bool MeshTriangle::Intersect(const Ray& ray, float& tnear, uint32_t& index) cons
   return intersect;
 }
 
-MeshTriangle::MeshTriangle(const std::string& filename, Material* mt) {
+MeshTriangle::MeshTriangle(const std::string& filename, Material* mt, BVHAccel::NodeLayout bvh_layout,
+                           BVHAccel::SplitMethod bvh_split) {
   objl::Loader loader;
   loader.LoadFile(filename);
   area = 0;
   m = mt;
+  materials.push_back(mt);
   assert(loader.LoadedMeshes.size() == 1);
   auto mesh = loader.LoadedMeshes[0];
 
@@ -77,15 +131,41 @@ MeshTriangle::MeshTriangle(const std::string& filename, Material* mt) {
       max_vert = Vector3f(std::max(max_vert.x, vert.x), std::max(max_vert.y, vert.y), std::max(max_vert.z, vert.z));
     }
 
-    triangles.emplace_back(face_vertices[0], face_vertices[1], face_vertices[2], mt);
+    triangles.Add(face_vertices[0], face_vertices[1], face_vertices[2], 0);
   }
 
   bounding_box = Bounds3(min_vert, max_vert);
 
-  std::vector<Object*> ptrs;
-  for (auto& tri : triangles) {
-    ptrs.push_back(&tri);
-    area += tri.area;
+  std::vector<Bounds3> tri_bounds(triangles.Size());
+  for (int i = 0; i < triangles.Size(); ++i) {
+    tri_bounds[i] = triangles.GetBounds(i);
+  }
+  bvh = std::make_unique<BVHAccel>(tri_bounds, 4, bvh_split, bvh_layout, TriangleBlock::kLanes);
+  // store the triangles in leaf order, so every leaf is a contiguous range
+  triangles.Reorder(bvh->PrimitiveOrder());
+
+  ComputeArea();
+}
+
+void MeshTriangle::Refit() {
+  std::vector<Bounds3> tri_bounds(triangles.Size());
+  bounding_box = Bounds3();
+  for (int i = 0; i < triangles.Size(); ++i) {
+    tri_bounds[i] = triangles.GetBounds(i);
+    bounding_box = Union(bounding_box, tri_bounds[i]);
+  }
+  if (bvh->Refit(tri_bounds))
+    triangles.Reorder(bvh->PrimitiveOrder());
+  ComputeArea();
+  ++refit_count_;
+}
+
+void MeshTriangle::ComputeArea() {
+  area = 0;
+  std::vector<float> areas(triangles.Size());
+  for (int i = 0; i < triangles.Size(); ++i) {
+    areas[i] = triangles.Area(i);
+    area += areas[i];
   }
-  bvh = new BVHAccel(ptrs);
+  triangle_table.Build(areas);
 }
@@ -15,7 +15,7 @@ bool Sphere::Intersect(const Ray& ray) {
     t0 = t1;
   if (t0 < 0)
     return false;
-  return true;
+  return t0 < ray.t_max;
 }
 
 bool Sphere::Intersect(const Ray& ray, float& tnear, uint32_t& index) const {
@@ -74,8 +74,9 @@ Bounds3 Sphere::GetBounds() {
                  Vector3f(center.x + radius, center.y + radius, center.z + radius));
 }
 
-void Sphere::Sample(Intersection& pos, float& pdf) {
-  float theta = 2.0 * kPi * GetRandomFloat(), phi = kPi * GetRandomFloat();
+void Sphere::Sample(Intersection& pos, float& pdf, Sampler& sampler) {
+  Vector2f u = sampler.Get2D();
+  float theta = 2.0 * kPi * u.x, phi = kPi * u.y;
   Vector3f dir(std::cos(phi), std::sin(phi) * std::cos(theta), std::sin(phi) * std::sin(theta));
   pos.coords = center + radius * dir;
   pos.normal = dir;
@@ -9,25 +9,21 @@ bool RayTriangleIntersect(const Vector3f& v0, const Vector3f& v1, const Vector3f
   Vector3f edge2 = v2 - v0;
   Vector3f pvec = CrossProduct(dir, edge2);
   float det = DotProduct(edge1, pvec);
-  if (det == 0 || det < 0)
+  if (std::fabs(det) < kEpsilon)
     return false;
 
+  float inv_det = 1 / det;
   Vector3f tvec = orig - v0;
-  u = DotProduct(tvec, pvec);
-  if (u < 0 || u > det)
+  u = DotProduct(tvec, pvec) * inv_det;
+  if (u < 0 || u > 1)
     return false;
 
   Vector3f qvec = CrossProduct(tvec, edge1);
-  v = DotProduct(dir, qvec);
-  if (v < 0 || u + v > det)
+  v = DotProduct(dir, qvec) * inv_det;
+  if (v < 0 || u + v > 1)
     return false;
 
-  float inv_det = 1 / det;
-
   tnear = DotProduct(edge2, qvec) * inv_det;
-  u *= inv_det;
-  v *= inv_det;
-
   return true;
 }
 
@@ -45,10 +41,12 @@ void Triangle::GetSurfaceProperties(const Vector3f& P, const Vector3f& I, const
   N = normal;
 }
 
-void Triangle::Sample(Intersection& pos, float& pdf) {
-  float x = std::sqrt(GetRandomFloat()), y = GetRandomFloat();
+void Triangle::Sample(Intersection& pos, float& pdf, Sampler& sampler) {
+  Vector2f u = sampler.Get2D();
+  float x = std::sqrt(u.x), y = u.y;
   pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
   pos.normal = this->normal;
+  pos.emit = m->GetEmission();
   pdf = 1.0f / area;
 }
 
@@ -61,7 +59,23 @@ bool Triangle::HasEmit() {
 }
 
 bool Triangle::Intersect(const Ray& ray) {
-  return true;
+  // same test as GetIntersection(), without building the hit record
+  Vector3f pvec = CrossProduct(ray.direction, e2);
+  double det = DotProduct(e1, pvec);
+  if (fabs(det) < kEpsilon)
+    return false;
+
+  double det_inv = 1. / det;
+  Vector3f tvec = ray.origin - v0;
+  double u = DotProduct(tvec, pvec) * det_inv;
+  if (u < 0 || u > 1)
+    return false;
+  Vector3f qvec = CrossProduct(tvec, e1);
+  double v = DotProduct(ray.direction, qvec) * det_inv;
+  if (v < 0 || u + v > 1)
+    return false;
+  double t = DotProduct(e2, qvec) * det_inv;
+  return t >= 0 && t < ray.t_max;
 }
 
 bool Triangle::Intersect(const Ray& ray, float& tnear, uint32_t& index) const {
@@ -75,8 +89,7 @@ Bounds3 Triangle::GetBounds() {
 Intersection Triangle::GetIntersection(Ray ray) {
   Intersection inter;
 
-  if (DotProduct(ray.direction, normal) > 0)
-    return inter;
+  // two-sided, the normal stays the one of the winding; materials tell the sides apart
   double u, v, t_tmp = 0;
   Vector3f pvec = CrossProduct(ray.direction, e2);
   double det = DotProduct(e1, pvec);
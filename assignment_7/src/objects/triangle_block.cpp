@@ -0,0 +1,159 @@
+#include "objects/triangle_block.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "global.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+void TriangleBlock::Add(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2, uint16_t material_index) {
+  Vector3f e1 = v1 - v0;
+  Vector3f e2 = v2 - v0;
+  for (int axis = 0; axis < 3; ++axis) {
+    // keep kLanes - 1 zero triangles behind the last one; they have det = 0 and never hit
+    v0_[axis].resize(size_ + kLanes, 0.f);
+    e1_[axis].resize(size_ + kLanes, 0.f);
+    e2_[axis].resize(size_ + kLanes, 0.f);
+    v0_[axis][size_] = v0[axis];
+    e1_[axis][size_] = e1[axis];
+    e2_[axis][size_] = e2[axis];
+  }
+  material_.push_back(material_index);
+  ++size_;
+}
+
+void TriangleBlock::Set(int i, const Vector3f& v0, const Vector3f& v1, const Vector3f& v2) {
+  Vector3f e1 = v1 - v0;
+  Vector3f e2 = v2 - v0;
+  for (int axis = 0; axis < 3; ++axis) {
+    v0_[axis][i] = v0[axis];
+    e1_[axis][i] = e1[axis];
+    e2_[axis][i] = e2[axis];
+  }
+}
+
+void TriangleBlock::Reorder(const std::vector<int>& order) {
+  auto permute = [&](std::vector<float>& values) {
+    std::vector<float> reordered(values.size(), 0.f);
+    for (size_t k = 0; k < order.size(); ++k) {
+      reordered[k] = values[order[k]];
+    }
+    values.swap(reordered);
+  };
+  for (int axis = 0; axis < 3; ++axis) {
+    permute(v0_[axis]);
+    permute(e1_[axis]);
+    permute(e2_[axis]);
+  }
+  std::vector<uint16_t> material(material_.size());
+  for (size_t k = 0; k < order.size(); ++k) {
+    material[k] = material_[order[k]];
+  }
+  material_.swap(material);
+}
+
+int TriangleBlock::IntersectLanes(const Ray& ray, int i, int n_valid, float t_max, float t[kLanes],
+                                  float u[kLanes], float v[kLanes]) const {
+  // Same test as Triangle::GetIntersection(): two-sided, only nearly parallel rays (|det| < kEpsilon) are rejected
+#if defined(__SSE__)
+  auto load = [i](const std::vector<float>& values) { return _mm_loadu_ps(values.data() + i); };
+  auto dot = [](__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+  };
+  auto cross_term = [](__m128 a1, __m128 b2, __m128 a2, __m128 b1) {
+    return _mm_sub_ps(_mm_mul_ps(a1, b2), _mm_mul_ps(a2, b1));
+  };
+
+  __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+  __m128 e1x = load(e1_[0]), e1y = load(e1_[1]), e1z = load(e1_[2]);
+  __m128 e2x = load(e2_[0]), e2y = load(e2_[1]), e2z = load(e2_[2]);
+
+  // pvec = dir x e2
+  __m128 px = cross_term(dy, e2z, dz, e2y);
+  __m128 py = cross_term(dz, e2x, dx, e2z);
+  __m128 pz = cross_term(dx, e2y, dy, e2x);
+  __m128 det = dot(e1x, e1y, e1z, px, py, pz);
+  __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+  // tvec = orig - v0
+  __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), load(v0_[0]));
+  __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin.y), load(v0_[1]));
+  __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), load(v0_[2]));
+  __m128 u4 = _mm_mul_ps(dot(tx, ty, tz, px, py, pz), inv_det);
+
+  // qvec = tvec x e1
+  __m128 qx = cross_term(ty, e1z, tz, e1y);
+  __m128 qy = cross_term(tz, e1x, tx, e1z);
+  __m128 qz = cross_term(tx, e1y, ty, e1x);
+  __m128 v4 = _mm_mul_ps(dot(dx, dy, dz, qx, qy, qz), inv_det);
+  __m128 t4 = _mm_mul_ps(dot(e2x, e2y, e2z, qx, qy, qz), inv_det);
+
+  __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+  // both sides count, so refracted rays can leave a closed mesh through its back faces
+  __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+  __m128 hit = _mm_cmpge_ps(abs_det, _mm_set1_ps(kEpsilon));
+  hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u4, zero), _mm_cmple_ps(u4, one)));
+  hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v4, zero), _mm_cmple_ps(_mm_add_ps(u4, v4), one)));
+  hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t4, zero), _mm_cmplt_ps(t4, _mm_set1_ps(t_max))));
+
+  _mm_storeu_ps(t, t4);
+  _mm_storeu_ps(u, u4);
+  _mm_storeu_ps(v, v4);
+  return _mm_movemask_ps(hit) & ((1 << n_valid) - 1);
+#else
+  int mask = 0;
+  for (int lane = 0; lane < n_valid; ++lane) {
+    int k = i + lane;
+    Vector3f e1 = E1(k), e2 = E2(k);
+    Vector3f pvec = CrossProduct(ray.direction, e2);
+    float det = DotProduct(e1, pvec);
+    if (std::fabs(det) < kEpsilon)
+      continue;
+    float inv_det = 1 / det;
+    Vector3f tvec = ray.origin - V0(k);
+    u[lane] = DotProduct(tvec, pvec) * inv_det;
+    if (u[lane] < 0 || u[lane] > 1)
+      continue;
+    Vector3f qvec = CrossProduct(tvec, e1);
+    v[lane] = DotProduct(ray.direction, qvec) * inv_det;
+    if (v[lane] < 0 || u[lane] + v[lane] > 1)
+      continue;
+    t[lane] = DotProduct(e2, qvec) * inv_det;
+    if (t[lane] >= 0 && t[lane] < t_max)
+      mask |= 1 << lane;
+  }
+  return mask;
+#endif
+}
+
+bool TriangleBlock::Intersect(const Ray& ray, int first, int count, float& t_max, int& index, float& u,
+                              float& v) const {
+  bool found = false;
+  float t_lanes[kLanes], u_lanes[kLanes], v_lanes[kLanes];
+  for (int i = first; i < first + count; i += kLanes) {
+    int mask = IntersectLanes(ray, i, std::min(kLanes, first + count - i), t_max, t_lanes, u_lanes, v_lanes);
+    for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+      // t_max shrinks as we go, so later lanes must still beat the closest one
+      if ((mask & 1) && t_lanes[lane] < t_max) {
+        t_max = t_lanes[lane];
+        index = i + lane;
+        u = u_lanes[lane];
+        v = v_lanes[lane];
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+bool TriangleBlock::IntersectP(const Ray& ray, int first, int count, float t_max) const {
+  float t_lanes[kLanes], u_lanes[kLanes], v_lanes[kLanes];
+  for (int i = first; i < first + count; i += kLanes) {
+    if (IntersectLanes(ray, i, std::min(kLanes, first + count - i), t_max, t_lanes, u_lanes, v_lanes))
+      return true;
+  }
+  return false;
+}
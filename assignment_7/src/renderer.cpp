@@ -1,47 +1,557 @@
 #include "renderer.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+
 #include "global.h"
+#include "image_io.h"
+#include "material.h"
 #include "scene.h"
+#include "utils/parallel.h"
+
+static_assert(sizeof(Vector3f) == 3 * sizeof(float), "framebuffers are written as raw floats");
 
 // The main render function.
 // This where we iterate over all pixels in the image, generate primary rays and cast these rays into the scene. The content of the framebuffer is saved to a file.
 
+void PixelStats::Add(const Vector3f& sample) {
+  ++n;
+  mean += (sample - mean) / n;
+  double luminance = 0.2126 * sample.x + 0.7152 * sample.y + 0.0722 * sample.z;
+  double delta = luminance - mean_luminance;
+  mean_luminance += delta / n;
+  m2 += delta * (luminance - mean_luminance);
+}
+
+double PixelStats::RelativeError() const {
+  if (n < 2)
+    return kInfinity;
+  double standard_error = std::sqrt(m2 / (n - 1) / n);
+  // pixels next to black are judged on an absolute scale
+  return standard_error / std::max(mean_luminance, 1e-3);
+}
+
+const char* AovName(Aov aov) {
+  switch (aov) {
+    case Aov::kAlbedo:
+      return "albedo";
+    case Aov::kNormal:
+      return "normal";
+    case Aov::kDepth:
+      return "depth";
+    case Aov::kSampleCount:
+      return "samples";
+  }
+  return "";
+}
+
+std::string AovPath(const std::string& output_file, Aov aov) {
+  size_t dot = output_file.find_last_of('.');
+  size_t slash = output_file.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = output_file.size();
+  return output_file.substr(0, dot) + "." + AovName(aov) + output_file.substr(dot);
+}
+
 void Renderer::Render(const Scene& scene) {
+  if (stream_output) {
+    if (progressive || adaptive || denoise || !aovs.empty())
+      std::cerr << "Streamed output renders a plain image, ignoring progressive, adaptive, denoise and AOV options\n";
+    RenderStreamed(scene);
+    return;
+  }
+
   std::vector<Vector3f> framebuffer(scene.width * scene.height);
+  std::vector<uint32_t> sample_counts(scene.width * scene.height, spp);
 
-  float scale = tan(Deg2Rad(scene.fov * 0.5));
-  float image_aspect_ratio = scene.width / (float)scene.height;
-  Vector3f eye_pos(278, 273, -800);
-  int m = 0;
-
-  // change the spp value to change sample ammount
-  int spp = 16;
-  std::cout << "SPP: " << spp << "\n";
-  for (uint32_t j = 0; j < scene.height; ++j) {
-    for (uint32_t i = 0; i < scene.width; ++i) {
-      // generate primary ray direction
-      float x = (2 * (i + 0.5) / (float)scene.width - 1) * image_aspect_ratio * scale;
-      float y = (1 - 2 * (j + 0.5) / (float)scene.height) * scale;
-
-      Vector3f dir = Normalize(Vector3f(-x, y, 1));
-      for (int k = 0; k < spp; k++) {
-        framebuffer[m] += scene.CastRay(Ray(eye_pos, dir), 0) / spp;
+  if (progressive) {
+    RenderProgressive(scene, framebuffer, sample_counts);
+  } else if (adaptive) {
+    RenderAdaptive(scene, framebuffer, sample_counts);
+  } else {
+    std::vector<Tile> tiles = MakeTiles(scene);
+    int threads = num_threads > 0 ? num_threads : NumSystemThreads();
+    std::cout << "SPP: " << spp << ", threads: " << threads << ", tile: " << tile_size << "x" << tile_size << "\n";
+
+    // Whoever finishes a tile reports progress, but only if nobody else is printing right now.
+    std::atomic<int> tiles_done{0};
+    std::mutex progress_mutex;
+
+    ParallelFor(
+        tiles.size(),
+        [&](int t) {
+          RenderTile(scene, tiles[t], framebuffer);
+
+          int done = ++tiles_done;
+          if (progress_mutex.try_lock()) {
+            UpdateProgress(done / (float)tiles.size());
+            progress_mutex.unlock();
+          }
+        },
+        threads);
+    UpdateProgress(1.f);
+  }
+
+  bool need_guides = denoise || std::any_of(aovs.begin(), aovs.end(), [](Aov aov) { return aov != Aov::kSampleCount; });
+  GuideBuffers guides;
+  if (need_guides)
+    guides = RenderGuides(scene);
+
+  if (denoise) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Vector3f> filtered;
+    denoiser.Denoise(framebuffer, guides, filtered);
+    framebuffer.swap(filtered);
+    std::cout << "Denoised in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+              << " s\n";
+  }
+
+  // save framebuffer to file
+  SaveImage(output_file, scene, framebuffer);
+
+  for (Aov aov : aovs) {
+    std::string file = AovPath(output_file, aov);
+    bool ok = false;
+    switch (aov) {
+      case Aov::kAlbedo:
+        ok = WriteImage(file, scene.width, scene.height, 3, &guides.albedo[0].x, exr_compression);
+        break;
+      case Aov::kNormal:
+        ok = WriteImage(file, scene.width, scene.height, 3, &guides.normal[0].x, exr_compression);
+        break;
+      case Aov::kDepth:
+        ok = WriteImage(file, scene.width, scene.height, 1, guides.depth.data(), exr_compression);
+        break;
+      case Aov::kSampleCount: {
+        std::vector<float> counts(sample_counts.begin(), sample_counts.end());
+        ok = WriteImage(file, scene.width, scene.height, 1, counts.data(), exr_compression);
+        break;
       }
-      m++;
     }
-    UpdateProgress(j / (float)scene.height);
+    if (!ok)
+      std::cerr << "Cannot write " << file << "\n";
   }
+}
+
+void Renderer::SaveImage(const std::string& file, const Scene& scene, const std::vector<Vector3f>& framebuffer) const {
+  if (!WriteImage(file, scene.width, scene.height, 3, &framebuffer[0].x, exr_compression))
+    std::cerr << "Cannot write " << file << "\n";
+}
+
+std::vector<Tile> Renderer::MakeTiles(const Scene& scene) const {
+  int tile = std::max(1, tile_size);
+  std::vector<Tile> tiles;
+  for (int y0 = 0; y0 < scene.height; y0 += tile) {
+    for (int x0 = 0; x0 < scene.width; x0 += tile) {
+      tiles.push_back({x0, y0, std::min(x0 + tile, scene.width), std::min(y0 + tile, scene.height)});
+    }
+  }
+  return tiles;
+}
+
+void Renderer::RenderTile(const Scene& scene, const Tile& tile, std::vector<Vector3f>& framebuffer,
+                          int first_row) const {
+  std::unique_ptr<Sampler> sampler = CreateSampler(sampler_type, seed);
+  int cached = std::min(spp, first_hit_samples);
+  std::vector<std::pair<Ray, Intersection>> first_hits;  // of the current pixel
+
+  for (int j = tile.y0; j < tile.y1; ++j) {
+    for (int i = tile.x0; i < tile.x1; ++i) {
+      Vector3f color;
+      if (cached > 0) {
+        first_hits.clear();
+        int path_dimension = 0;  // the first one past the pixel jitter
+        for (int k = 0; k < cached; k++) {
+          sampler->StartPixelSample(i, j, k);
+          Ray ray = CameraRay(scene, i, j, sampler->Get2D());
+          path_dimension = sampler->Dimension();
+          first_hits.emplace_back(ray, scene.Intersect(ray));
+        }
+        for (int k = 0; k < spp; k++) {
+          sampler->StartPixelSample(i, j, k);
+          sampler->SetDimension(path_dimension);
+          const auto& [ray, hit] = first_hits[k % cached];
+          color += scene.CastRay(ray, hit, 0, *sampler);
+        }
+      } else {
+        for (int k = 0; k < spp; k++) {
+          color += SamplePixel(scene, *sampler, i, j, k);
+        }
+      }
+      // summed first and divided once, as RenderState::Resolve() does, so progressive renders match bit for bit
+      framebuffer[(j - first_row) * scene.width + i] = color / spp;
+    }
+  }
+}
+
+void Renderer::RenderStreamed(const Scene& scene) const {
+  std::unique_ptr<ImageWriter> writer =
+      CreateImageWriter(output_file, scene.width, scene.height, 3, exr_compression);
+  if (writer == nullptr) {
+    std::cerr << "Cannot write " << output_file << "\n";
+    return;
+  }
+  int tile = std::max(1, tile_size);
+  std::vector<Tile> tiles = MakeTiles(scene);  // row of tiles after row of tiles, each row a band
+  int tiles_per_band = (scene.width + tile - 1) / tile;
+  int num_bands = (scene.height + tile - 1) / tile;
+  int threads = num_threads > 0 ? num_threads : NumSystemThreads();
+  // enough bands that every worker finds a tile while the oldest band waits for its slowest one
+  int slots = std::min(num_bands, 2 + (threads - 1) / tiles_per_band);
+  std::vector<std::vector<Vector3f>> bands(slots, std::vector<Vector3f>((size_t)scene.width * tile));
+  std::cout << "SPP: " << spp << ", threads: " << threads << ", tile: " << tile << "x" << tile << ", streaming to "
+            << output_file << " through " << slots << " bands of " << bands[0].size() * sizeof(Vector3f) / 1024
+            << " KB\n";
+
+  std::mutex mutex;
+  std::condition_variable band_written;
+  std::vector<int> tiles_left(num_bands, tiles_per_band);
+  int next_band = 0;  // the oldest band not written yet
+  bool ok = true;
+
+  ParallelFor(
+      tiles.size(),
+      [&](int t) {
+        int band = t / tiles_per_band;
+        std::vector<Vector3f>& buffer = bands[band % slots];
+        {
+          // the buffer is free once the band before that used it is written
+          std::unique_lock<std::mutex> lock(mutex);
+          band_written.wait(lock, [&] { return band < next_band + slots; });
+        }
+        RenderTile(scene, tiles[t], buffer, band * tile);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        --tiles_left[band];
+        // whoever finishes the oldest band writes it, along with any later ones already complete
+        bool wrote = false;
+        while (next_band < num_bands && tiles_left[next_band] == 0) {
+          int rows = std::min(tile, scene.height - next_band * tile);
+          ok = writer->WriteRows(&bands[next_band % slots][0].x, rows) && ok;
+          ++next_band;
+          wrote = true;
+        }
+        if (wrote) {
+          band_written.notify_all();
+          UpdateProgress(next_band / (float)num_bands);
+        }
+      },
+      threads);
   UpdateProgress(1.f);
 
-  // save framebuffer to file
-  FILE* fp = fopen("binary.ppm", "wb");
-  (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-  for (auto i = 0; i < scene.height * scene.width; ++i) {
-    static unsigned char color[3];
-    color[0] = (unsigned char)(255 * std::pow(Clamp(0, 1, framebuffer[i].x), 0.6f));
-    color[1] = (unsigned char)(255 * std::pow(Clamp(0, 1, framebuffer[i].y), 0.6f));
-    color[2] = (unsigned char)(255 * std::pow(Clamp(0, 1, framebuffer[i].z), 0.6f));
-    fwrite(color, 1, 3, fp);
+  if (!writer->Close() || !ok)
+    std::cerr << "Cannot write " << output_file << "\n";
+}
+
+void Renderer::RenderAdaptive(const Scene& scene, std::vector<Vector3f>& framebuffer,
+                              std::vector<uint32_t>& sample_counts) const {
+  int num_pixels = scene.width * scene.height;
+  int64_t budget = (int64_t)std::max(1, spp) * num_pixels;
+  // the variance needs two samples, but the first pass must fit in the budget
+  int batch = std::max(1, std::min(std::max(2, adaptive_min_spp), spp));
+  int max_spp = std::max(batch, adaptive_max_spp);
+  std::vector<Tile> tiles = MakeTiles(scene);
+  int threads = num_threads > 0 ? num_threads : NumSystemThreads();
+  std::cout << "Adaptive SPP: " << spp << " on average, " << batch << " to " << max_spp << " per pixel, threshold "
+            << adaptive_threshold << ", threads: " << threads << "\n";
+
+  std::vector<PixelStats> stats(num_pixels);
+  std::vector<int> pass_samples(num_pixels, 0);  // samples each pixel takes in the current pass
+  int64_t used = 0;
+  int passes = 0;
+  while (true) {
+    // Pick the pixels to refine, worst first, as far as the budget reaches
+    std::vector<std::pair<double, int>> candidates;
+    for (int p = 0; p < num_pixels; ++p) {
+      double error = stats[p].RelativeError();
+      if (stats[p].n + batch <= max_spp && error > adaptive_threshold)
+        candidates.emplace_back(error, p);
+    }
+    // every pixel takes its first batch whatever the budget, later passes refine the worst pixels only
+    int64_t affordable = (budget - used) / batch;
+    if (passes > 0 && affordable < (int64_t)candidates.size()) {
+      std::nth_element(candidates.begin(), candidates.begin() + affordable, candidates.end(),
+                       [](const auto& a, const auto& b) { return a.first > b.first; });
+      candidates.resize(affordable);
+    }
+    if (candidates.empty())
+      break;
+    std::fill(pass_samples.begin(), pass_samples.end(), 0);
+    for (const auto& c : candidates) {
+      pass_samples[c.second] = batch;
+    }
+
+    ParallelFor(
+        tiles.size(),
+        [&](int t) {
+          std::unique_ptr<Sampler> sampler = CreateSampler(sampler_type, seed);
+          for (int j = tiles[t].y0; j < tiles[t].y1; ++j) {
+            for (int i = tiles[t].x0; i < tiles[t].x1; ++i) {
+              PixelStats& pixel = stats[j * scene.width + i];
+              // sample indices continue where the last pass stopped, keeping the pixel's samples stratified
+              for (int s = pass_samples[j * scene.width + i]; s > 0; --s) {
+                pixel.Add(SamplePixel(scene, *sampler, i, j, pixel.n));
+              }
+            }
+          }
+        },
+        threads);
+    used += (int64_t)candidates.size() * batch;
+    ++passes;
+    UpdateProgress(used / (double)budget);
+  }
+  UpdateProgress(1.f);
+
+  int converged = 0;
+  int most_samples = 1;
+  for (int p = 0; p < num_pixels; ++p) {
+    framebuffer[p] = stats[p].mean;
+    sample_counts[p] = stats[p].n;
+    converged += stats[p].RelativeError() <= adaptive_threshold;
+    most_samples = std::max(most_samples, stats[p].n);
   }
+  std::cout << "\nAdaptive sampling: " << passes << " passes, " << used / (double)num_pixels
+            << " spp on average, " << 100.0 * converged / num_pixels << "% of pixels converged\n";
+
+  if (!heat_map_file.empty()) {
+    // black -> red -> yellow -> white with the share of the largest sample count
+    std::vector<unsigned char> heat_map(3 * num_pixels);
+    for (int p = 0; p < num_pixels; ++p) {
+      float t = 3.f * stats[p].n / most_samples;
+      heat_map[3 * p + 0] = (unsigned char)(255 * Clamp(0, 1, t));
+      heat_map[3 * p + 1] = (unsigned char)(255 * Clamp(0, 1, t - 1));
+      heat_map[3 * p + 2] = (unsigned char)(255 * Clamp(0, 1, t - 2));
+    }
+    // written as is: WriteImage() would gamma correct the ramp
+    FILE* fp = fopen(heat_map_file.c_str(), "wb");
+    bool ok = fp != nullptr;
+    if (ok) {
+      ok = fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height) > 0;
+      ok = fwrite(heat_map.data(), 1, heat_map.size(), fp) == heat_map.size() && ok;
+      ok = fclose(fp) == 0 && ok;
+    }
+    if (!ok)
+      std::cerr << "Cannot write " << heat_map_file << "\n";
+  }
+}
+
+int Renderer::RenderProgressive(const Scene& scene, std::vector<Vector3f>& framebuffer,
+                                std::vector<uint32_t>& sample_counts) const {
+  using Clock = std::chrono::steady_clock;
+  std::vector<Tile> tiles = MakeTiles(scene);
+  int threads = num_threads > 0 ? num_threads : NumSystemThreads();
+  std::cout << "Progressive: up to " << spp << " spp";
+  if (time_budget > 0)
+    std::cout << " within " << time_budget << " s";
+  std::cout << ", threads: " << threads << "\n";
+
+  RenderState state;
+  state.accumulation.resize(scene.width * scene.height);
+  state.sample_counts.resize(scene.width * scene.height);
+  if (!checkpoint_file.empty() && LoadCheckpoint(checkpoint_file, scene, state))
+    std::cout << "Resuming from " << checkpoint_file << " at " << state.passes << " spp\n";
+
+  auto start = Clock::now();
+  auto last_checkpoint = start;
+  double longest_pass = 0;
+  int first_pass = state.passes;
+  while (state.passes < std::max(1, spp) && !cancel) {
+    auto pass_start = Clock::now();
+    // stop before a pass that would not fit in the budget, but always render one
+    if (state.passes > first_pass && time_budget > 0 &&
+        std::chrono::duration<double>(pass_start - start).count() + longest_pass > time_budget)
+      break;
+
+    ParallelFor(
+        tiles.size(),
+        [&](int t) {
+          std::unique_ptr<Sampler> sampler = CreateSampler(sampler_type, seed);
+          for (int j = tiles[t].y0; j < tiles[t].y1; ++j) {
+            for (int i = tiles[t].x0; i < tiles[t].x1; ++i) {
+              int p = j * scene.width + i;
+              state.accumulation[p] += SamplePixel(scene, *sampler, i, j, state.sample_counts[p]++);
+            }
+          }
+        },
+        threads);
+    ++state.passes;
+
+    auto now = Clock::now();
+    longest_pass = std::max(longest_pass, std::chrono::duration<double>(now - pass_start).count());
+    float progress = state.passes / (float)std::max(1, spp);
+    if (time_budget > 0)
+      progress = std::max(progress, (float)(std::chrono::duration<double>(now - start).count() / time_budget));
+    UpdateProgress(std::min(progress, 1.f));
+
+    if (!checkpoint_file.empty() &&
+        std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval) {
+      SaveCheckpoint(checkpoint_file, scene, state);
+      last_checkpoint = now;
+    }
+    if (on_pass) {
+      state.Resolve(framebuffer);
+      on_pass(framebuffer, state.passes);
+    }
+  }
+  UpdateProgress(1.f);
+
+  // whatever ended the render, the next job continues from here
+  if (!checkpoint_file.empty() && state.passes > first_pass)
+    SaveCheckpoint(checkpoint_file, scene, state);
+
+  state.Resolve(framebuffer);
+  sample_counts = state.sample_counts;
+  std::cout << "\nProgressive rendering: " << state.passes << " spp in "
+            << std::chrono::duration<double>(Clock::now() - start).count() << " s" << (cancel ? ", cancelled" : "")
+            << "\n";
+  return state.passes;
+}
+
+void RenderState::Resolve(std::vector<Vector3f>& framebuffer) const {
+  for (size_t p = 0; p < accumulation.size(); ++p) {
+    framebuffer[p] = sample_counts[p] > 0 ? accumulation[p] / sample_counts[p] : Vector3f(0.f);
+  }
+}
+
+GuideBuffers Renderer::RenderGuides(const Scene& scene) const {
+  GuideBuffers guides;
+  guides.width = scene.width;
+  guides.height = scene.height;
+  guides.albedo.resize(scene.width * scene.height);
+  guides.normal.resize(scene.width * scene.height);
+  guides.depth.resize(scene.width * scene.height);
+  int samples = std::max(1, guide_samples);
+
+  ParallelFor(
+      scene.height,
+      [&](int j) {
+        std::unique_ptr<Sampler> sampler = CreateSampler(sampler_type, seed);
+        for (int i = 0; i < scene.width; ++i) {
+          Vector3f albedo, normal;
+          float depth = 0;
+          int hits = 0;
+          for (int k = 0; k < samples; ++k) {
+            sampler->StartPixelSample(i, j, k);
+            Intersection hit = scene.Intersect(CameraRay(scene, i, j, sampler->Get2D()));
+            if (!hit.happened)
+              continue;
+            albedo += hit.m->type == kDiffuse ? hit.m->kd : hit.m->ks;
+            normal += hit.normal;
+            depth += hit.distance;
+            ++hits;
+          }
+          int p = j * scene.width + i;
+          // pixels that only partly see the scene get the mean of the surfaces they see
+          guides.albedo[p] = hits > 0 ? albedo / hits : Vector3f(0.f);
+          guides.normal[p] = hits > 0 ? normal / hits : Vector3f(0.f);
+          guides.depth[p] = hits > 0 ? depth / hits : kInfinity;
+        }
+      },
+      num_threads);
+  return guides;
+}
+
+// ----------------------------------------------------------------------------: checkpoint
+
+namespace {
+
+// Checkpoint layout, little endian as written by the host:
+//   CheckpointHeader
+//   uint32_t sample_counts[width * height]
+//   float    accumulation[width * height][3]
+// The samplers need no state of their own: sample k of a pixel is a function of (pixel, k, seed, sampler type), so
+// the sample counts are all it takes to continue every pixel's sequence.
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  int32_t sampler_type;
+  uint64_t seed;
+  int32_t passes;
+  int32_t max_depth;
+};
+
+constexpr char kCheckpointMagic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+constexpr uint32_t kCheckpointVersion = 1;
+
+
+}  // namespace
+
+bool Renderer::LoadCheckpoint(const std::string& file, const Scene& scene, RenderState& state) const {
+  FILE* fp = fopen(file.c_str(), "rb");
+  if (fp == nullptr)
+    return false;
+
+  CheckpointHeader header;
+  size_t n = scene.width * scene.height;
+  std::vector<uint32_t> sample_counts(n);
+  std::vector<Vector3f> accumulation(n);
+  bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+            std::equal(kCheckpointMagic, kCheckpointMagic + 8, header.magic) &&
+            header.version == kCheckpointVersion && header.width == scene.width && header.height == scene.height &&
+            header.sampler_type == (int32_t)sampler_type && header.seed == seed &&
+            header.max_depth == scene.max_depth && fread(sample_counts.data(), sizeof(uint32_t), n, fp) == n &&
+            fread(accumulation.data(), sizeof(Vector3f), n, fp) == n;
   fclose(fp);
+  if (!ok) {
+    std::cerr << "Ignoring checkpoint " << file << ": unreadable or made with other settings\n";
+    return false;
+  }
+  state.passes = header.passes;
+  state.sample_counts = std::move(sample_counts);
+  state.accumulation = std::move(accumulation);
+  return true;
+}
+
+void Renderer::SaveCheckpoint(const std::string& file, const Scene& scene, const RenderState& state) const {
+  CheckpointHeader header{};
+  std::copy(kCheckpointMagic, kCheckpointMagic + 8, header.magic);
+  header.version = kCheckpointVersion;
+  header.width = scene.width;
+  header.height = scene.height;
+  header.sampler_type = (int32_t)sampler_type;
+  header.seed = seed;
+  header.passes = state.passes;
+  header.max_depth = scene.max_depth;
+
+  // written next to the old one and renamed over it, so being killed mid-write leaves the last checkpoint intact
+  std::string temp = file + ".tmp";
+  FILE* fp = fopen(temp.c_str(), "wb");
+  if (fp == nullptr) {
+    std::cerr << "Cannot write checkpoint " << temp << "\n";
+    return;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(state.sample_counts.data(), sizeof(uint32_t), state.sample_counts.size(), fp) ==
+                state.sample_counts.size() &&
+            fwrite(state.accumulation.data(), sizeof(Vector3f), state.accumulation.size(), fp) ==
+                state.accumulation.size();
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || std::rename(temp.c_str(), file.c_str()) != 0)
+    std::cerr << "Cannot write checkpoint " << file << "\n";
+}
+
+// ----------------------------------------------------------------------------: sampling
+
+Vector3f Renderer::SamplePixel(const Scene& scene, Sampler& sampler, int i, int j, int k) const {
+  sampler.StartPixelSample(i, j, k);
+  // the pixel jitter is the first sampler dimension
+  return scene.CastRay(CameraRay(scene, i, j, sampler.Get2D()), 0, sampler);
+}
+
+Ray Renderer::CameraRay(const Scene& scene, int i, int j, const Vector2f& jitter) const {
+  float scale = tan(Deg2Rad(scene.fov * 0.5));
+  float image_aspect_ratio = scene.width / (float)scene.height;
+  Vector3f eye_pos(278, 273, -800);
+
+  // generate primary ray direction
+  float x = (2 * (i + jitter.x) / (float)scene.width - 1) * image_aspect_ratio * scale;
+  float y = (1 - 2 * (j + jitter.y) / (float)scene.height) * scale;
+  Vector3f dir = Normalize(Vector3f(-x, y, 1));
+  return Ray(eye_pos, dir);
 }
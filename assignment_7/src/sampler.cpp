@@ -0,0 +1,132 @@
+#include "sampler.h"
+
+#include <algorithm>
+
+namespace {
+
+inline uint32_t ReverseBits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+  x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+  x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+  x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+  return x;
+}
+
+// Hash in which every bit only depends on the bits below it, i.e. a random permutation of the binary tree of
+// prefixes of the reversed value (Laine and Karras, improved constants by Burley)
+inline uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+// Owen scrambling of a 0.32 fixed point value
+inline uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+  return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+// Second Sobol dimension; the first one is ReverseBits(index)
+inline uint32_t SobolDimension1(uint32_t index) {
+  uint32_t result = 0;
+  for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+    if (index & 1)
+      result ^= v;
+  }
+  return result;
+}
+
+inline float ToUnitFloat(uint32_t x) {
+  return std::min(0x1.fffffep-1f, x * 0x1p-32f);
+}
+
+}  // namespace
+
+// ----------------------------------------------------------------------------: pcg32
+
+void Pcg32::SetSequence(uint64_t seq_index, uint64_t seed) {
+  state_ = 0u;
+  inc_ = (seq_index << 1u) | 1u;
+  Uniform32();
+  state_ += seed;
+  Uniform32();
+}
+
+void Pcg32::Advance(int64_t delta) {
+  // See "Random Number Generation with Arbitrary Strides", F. Brown
+  uint64_t cur_mult = kMultiplier, cur_plus = inc_, acc_mult = 1u, acc_plus = 0u;
+  uint64_t d = (uint64_t)delta;
+  while (d > 0) {
+    if (d & 1) {
+      acc_mult *= cur_mult;
+      acc_plus = acc_plus * cur_mult + cur_plus;
+    }
+    cur_plus = (cur_mult + 1) * cur_plus;
+    cur_mult *= cur_mult;
+    d /= 2;
+  }
+  state_ = acc_mult * state_ + acc_plus;
+}
+
+uint32_t Pcg32::Uniform32() {
+  uint64_t old_state = state_;
+  state_ = old_state * kMultiplier + inc_;
+  uint32_t xor_shifted = (uint32_t)(((old_state >> 18u) ^ old_state) >> 27u);
+  uint32_t rot = (uint32_t)(old_state >> 59u);
+  return (xor_shifted >> rot) | (xor_shifted << ((~rot + 1u) & 31));
+}
+
+float Pcg32::UniformFloat() {
+  // scale by 2^-32 and clamp, so that rounding never yields exactly 1
+  return std::min(0x1.fffffep-1f, Uniform32() * 0x1p-32f);
+}
+
+// ----------------------------------------------------------------------------: independent sampler
+
+void IndependentSampler::StartPixelSample(int x, int y, int sample_index) {
+  uint64_t pixel = ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+  rng_.SetSequence(MixBits(pixel ^ MixBits(seed_)));
+  dimension_ = 0;
+  // each sample gets its own window of 2^16 values in the pixel's stream
+  rng_.Advance((int64_t)sample_index * 65536);
+}
+
+// ----------------------------------------------------------------------------: sobol sampler
+
+void SobolSampler::StartPixelSample(int x, int y, int sample_index) {
+  uint64_t pixel = ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+  pixel_seed_ = MixBits(pixel ^ MixBits(seed_ + 1));
+  sample_index_ = sample_index;
+  dimension_ = 0;
+}
+
+float SobolSampler::Get1D() {
+  uint32_t seed = DimensionSeed();
+  ++dimension_;
+  uint32_t index = NestedUniformScramble(sample_index_, seed);
+  return ToUnitFloat(NestedUniformScramble(ReverseBits(index), (uint32_t)MixBits(seed)));
+}
+
+Vector2f SobolSampler::Get2D() {
+  uint32_t seed = DimensionSeed();
+  ++dimension_;
+  uint32_t index = NestedUniformScramble(sample_index_, seed);
+  uint32_t x = NestedUniformScramble(ReverseBits(index), (uint32_t)MixBits(seed));
+  uint32_t y = NestedUniformScramble(SobolDimension1(index), (uint32_t)MixBits(seed + 1));
+  return Vector2f(ToUnitFloat(x), ToUnitFloat(y));
+}
+
+// ----------------------------------------------------------------------------: factory
+
+std::unique_ptr<Sampler> CreateSampler(SamplerType type, uint64_t seed) {
+  switch (type) {
+    case SamplerType::kIndependent:
+      return std::make_unique<IndependentSampler>(seed);
+    case SamplerType::kSobol:
+      return std::make_unique<SobolSampler>(seed);
+  }
+  return nullptr;
+}
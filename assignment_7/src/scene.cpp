@@ -1,32 +1,156 @@
 #include "scene.h"
 
-void Scene::BuildBVH() {
-  printf(" - Generating BVH...\n\n");
-  this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::kNaive);
+#include <algorithm>
+#include <cmath>
+
+#include "material.h"
+
+namespace {
+
+// Offset applied to both ends of a shadow ray, in scene units
+constexpr float kShadowEpsilon = 0.001f;
+// Offset of a scattered ray's origin from the surface it leaves, along the normal
+constexpr float kScatterEpsilon = 0.001f;
+// Russian roulette only starts after this many bounces, short paths carry most of the image
+constexpr int kRouletteMinBounces = 3;
+// Sampler dimensions reserved per bounce: emitter, triangle and point on the light, BSDF direction and lobe, and
+// roulette. Every bounce starts at a fixed dimension, so each decision of a path draws from the same dimension in
+// every sample of the pixel.
+constexpr int kDimensionsPerBounce = 6;
+
+// Veach's power heuristic (beta = 2) for one sample of each of two strategies
+inline float PowerHeuristic(float pdf_f, float pdf_g) {
+  float f = pdf_f * pdf_f, g = pdf_g * pdf_g;
+  return f + g > 0 ? f / (f + g) : 0;
 }
 
-Intersection Scene::Intersect(const Ray& ray) const {
-  return this->bvh->Intersect(ray);
+}  // namespace
+
+void Scene::Add(Object* object) {
+  objects.push_back(object);
+  if (!dynamic_bvh)
+    return;
+  placements_[object] = {(int)objects.size() - 1, dynamic_bvh->Insert(object)};
+  if (object->HasEmit()) {
+    emitters.push_back(object);
+    WeighEmitters();
+  }
 }
 
-void Scene::SampleLight(Intersection& pos, float& pdf) const {
-  float emit_area_sum = 0;
-  for (uint32_t k = 0; k < objects.size(); ++k) {
-    if (objects[k]->HasEmit()) {
-      emit_area_sum += objects[k]->GetArea();
+bool Scene::Remove(Object* object) {
+  if (!dynamic_bvh) {
+    // the list keeps its order, so the next BuildBVH() builds the tree it would have built without the object
+    auto it = std::find(objects.begin(), objects.end(), object);
+    if (it == objects.end())
+      return false;
+    objects.erase(it);
+    return true;
+  }
+  // the last object fills the gap, so removing is O(1) here as well
+  auto placement = placements_.find(object);
+  if (placement == placements_.end())
+    return false;
+  Object* last = objects.back();
+  objects[placement->second.index] = last;
+  placements_[last].index = placement->second.index;
+  objects.pop_back();
+  dynamic_bvh->Remove(placement->second.proxy);
+  placements_.erase(placement);
+  if (object->HasEmit()) {
+    emitters.erase(std::find(emitters.begin(), emitters.end(), object));
+    WeighEmitters();
+  }
+  return true;
+}
+
+void Scene::Update(Object* object) {
+  if (!dynamic_bvh)
+    return;
+  dynamic_bvh->Move(placements_.at(object).proxy);
+  if (object->HasEmit())
+    WeighEmitters();  // its area may have changed
+}
+
+void Scene::BuildBVH() {
+  printf(" - Generating BVH...\n\n");
+  placements_.clear();
+  if (dynamic_top_level) {
+    this->bvh.reset();
+    this->dynamic_bvh = std::make_unique<DynamicBvh>();
+    for (size_t i = 0; i < objects.size(); ++i) {
+      placements_[objects[i]] = {(int)i, dynamic_bvh->Insert(objects[i])};
     }
+  } else {
+    this->dynamic_bvh.reset();
+    this->bvh = std::make_unique<BVHAccel>(objects, 1, bvh_split, bvh_layout);
   }
-  float p = GetRandomFloat() * emit_area_sum;
-  emit_area_sum = 0;
-  for (uint32_t k = 0; k < objects.size(); ++k) {
-    if (objects[k]->HasEmit()) {
-      emit_area_sum += objects[k]->GetArea();
-      if (p <= emit_area_sum) {
-        objects[k]->Sample(pos, pdf);
-        break;
-      }
+  BuildEmitterTable();
+}
+
+void Scene::RefitBVH() {
+  if (dynamic_bvh) {
+    for (const auto& placement : placements_) {
+      dynamic_bvh->Move(placement.second.proxy);
     }
+  } else {
+    this->bvh->Refit();
   }
+  BuildEmitterTable();
+}
+
+void Scene::BuildEmitterTable() {
+  emitters.clear();
+  for (Object* object : objects) {
+    if (object->HasEmit())
+      emitters.push_back(object);
+  }
+  WeighEmitters();
+}
+
+void Scene::WeighEmitters() {
+  std::vector<float> areas;
+  for (Object* object : emitters) {
+    // degenerate emitters get no weight, so they are never sampled and add nothing to emitter_area
+    float area = object->GetArea();
+    areas.push_back(std::isfinite(area) && area > 0 ? area : 0);
+  }
+  emitter_table.Build(areas);
+  emitter_area = 0;
+  for (float area : areas) {
+    emitter_area += area;
+  }
+}
+
+Intersection Scene::Intersect(const Ray& ray) const {
+  return dynamic_bvh ? dynamic_bvh->Intersect(ray) : this->bvh->Intersect(ray);
+}
+
+bool Scene::IntersectP(const Ray& ray) const {
+  return dynamic_bvh ? dynamic_bvh->IntersectP(ray) : this->bvh->IntersectP(ray);
+}
+
+bool Scene::Visible(const Vector3f& p0, const Vector3f& p1) const {
+  Vector3f d = p1 - p0;
+  float dist = d.Norm();
+  if (dist <= 2 * kShadowEpsilon)
+    return true;
+  Vector3f dir = d / dist;
+  Ray ray(p0 + dir * kShadowEpsilon, dir);
+  ray.t_max = dist - 2 * kShadowEpsilon;
+  return !IntersectP(ray);
+}
+
+void Scene::SampleLight(Intersection& pos, float& pdf, Sampler& sampler) const {
+  float pmf;
+  int index = emitter_table.Sample(sampler.Get1D(), &pmf);
+  if (index < 0) {
+    pdf = 0;
+    return;
+  }
+  Object* emitter = emitters[index];
+  emitter->Sample(pos, pdf, sampler);
+  // the emitter's own pdf is over its area only
+  pdf *= pmf;
 }
 
 bool Scene::Trace(const Ray& ray, const std::vector<Object*>& objects, float& t_near, uint32_t& index,
@@ -47,9 +171,89 @@ bool Scene::Trace(const Ray& ray, const std::vector<Object*>& objects, float& t_
 }
 
 // Implementation of Path Tracing
-Vector3f Scene::CastRay(const Ray& ray, int depth) const {
-  // TODO: Implement Path Tracing Algorithm here
-  return Vector3f();
+//
+// Iterative unidirectional path tracer. At every vertex the direct light is estimated twice, by sampling a point on
+// the emitters (next-event estimation) and by the BSDF sample that continues the path, and the two estimates are
+// combined with the power heuristic. Paths end after max_depth bounces or by throughput-based Russian roulette.
+Vector3f Scene::CastRay(const Ray& ray, int depth, Sampler& sampler) const {
+  return CastRay(ray, Intersect(ray), depth, sampler);
+}
+
+Vector3f Scene::CastRay(const Ray& ray, const Intersection& first_hit, int depth, Sampler& sampler) const {
+  Vector3f radiance(0.f);
+  Vector3f throughput(1.f);
+  Ray path_ray = ray;
+  Intersection hit = first_hit;
+  float bsdf_pdf = 0;  // solid angle pdf of the BSDF sample that found hit, 0 for camera rays
+  int first_dimension = sampler.Dimension();
+
+  for (int bounce = depth;; ++bounce) {
+    if (!hit.happened)
+      break;
+    sampler.SetDimension(first_dimension + (bounce - depth) * kDimensionsPerBounce);
+    Material* m = hit.m;
+    Vector3f p = hit.coords;
+    Vector3f N = hit.normal;
+    Vector3f wi = path_ray.direction;
+    // Surfaces are hit from both sides and report the normal of their winding (outwards for spheres).
+    bool back_face = DotProduct(N, wi) > 0;
+
+    // Emitter found by the path: seen directly, or weighted against the light sample that could have found it.
+    // Emitters only shine to the front, as SampleLight() assumes.
+    if (m->HasEmission() && !back_face) {
+      float weight = 1;
+      if (bsdf_pdf > 0) {
+        float cos_light = -DotProduct(N, wi);
+        float light_pdf = cos_light > 0 ? hit.distance * hit.distance / (cos_light * emitter_area) : 0;
+        weight = PowerHeuristic(bsdf_pdf, light_pdf);
+      }
+      radiance += throughput * m->GetEmission() * weight;
+    }
+    if (bounce - depth >= max_depth)
+      break;
+    // Opaque materials scatter back to the side the ray came from. A dielectric keeps the normal of the winding, whose
+    // side of wi tells it whether the ray enters or leaves.
+    if (back_face && m->GetType() != kDielectric)
+      N = -N;
+
+    // Next-event estimation
+    Intersection light;
+    float light_area_pdf;
+    SampleLight(light, light_area_pdf, sampler);
+    if (light_area_pdf > 0) {
+      Vector3f to_light = light.coords - p;
+      float dist2 = DotProduct(to_light, to_light);
+      Vector3f ws = Normalize(to_light);
+      float cos_surface = DotProduct(N, ws);
+      float cos_light = -DotProduct(light.normal, ws);
+      // the BSDF decides which side of the surface it scatters to
+      if (cos_surface != 0 && cos_light > 0 && Visible(p, light.coords)) {
+        float light_pdf = light_area_pdf * dist2 / cos_light;
+        float weight = PowerHeuristic(light_pdf, m->Pdf(wi, ws, N));
+        radiance += throughput * light.emit * m->Eval(wi, ws, N) * (std::fabs(cos_surface) * weight / light_pdf);
+      }
+    }
+
+    // Continue the path along a BSDF sample
+    Vector3f wo = m->Sample(wi, N, sampler);
+    bsdf_pdf = m->Pdf(wi, wo, N);
+    float cos_wo = DotProduct(N, wo);
+    if (bsdf_pdf <= 0 || cos_wo == 0)
+      break;
+    throughput = throughput * m->Eval(wi, wo, N) * (std::fabs(cos_wo) / bsdf_pdf);
+
+    if (bounce - depth >= kRouletteMinBounces) {
+      sampler.SetDimension(first_dimension + (bounce - depth + 1) * kDimensionsPerBounce - 1);
+      float survive = std::min(russian_roulette, std::max({throughput.x, throughput.y, throughput.z}));
+      if (sampler.Get1D() >= survive)
+        break;
+      throughput = throughput / survive;
+    }
+
+    path_ray = Ray(p + N * (cos_wo > 0 ? kScatterEpsilon : -kScatterEpsilon), wo);
+    hit = Intersect(path_ray);
+  }
+  return radiance;
 }
 
 void Scene::Fresnel(const Vector3f& I, const Vector3f& N, const float& ior, float& kr) const {